@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "AudioBuffer.h"
+#include "Simd.h"
+#include <cstring>
+#if defined(_MSC_VER)
+# include <stdlib.h>
+#endif
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+static inline uint32_t bswap32(uint32_t x)
+{
+#if defined(_MSC_VER)
+    return _byteswap_ulong(x);
+#else
+    return __builtin_bswap32(x);
+#endif
+}
+
+static void ByteSwap32_C(uint8_t* p, size_t count)
+{
+    for (size_t i = 0; i < count; ++i, p += 4) {
+        uint32_t x;
+        memcpy(&x, p, 4);
+        x = bswap32(x);
+        memcpy(p, &x, 4);
+    }
+}
+
+#if (R3D_X86 + 0)
+static size_t ByteSwap32_SSE2(uint8_t* p, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, p += 16) {
+        auto v = _mm_loadu_si128((const __m128i*)p);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); // swap bytes in 16bit
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1)); // swap 16bit in 32bit
+        _mm_storeu_si128((__m128i*)p, v);
+    }
+    return i;
+}
+
+# if (R3D_AVX2 + 0)
+R3D_TARGET("avx2") static size_t ByteSwap32_AVX2(uint8_t* p, size_t count)
+{
+    const auto mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                       3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, p += 32) {
+        const auto v = _mm256_loadu_si256((const __m256i*)p);
+        _mm256_storeu_si256((__m256i*)p, _mm256_shuffle_epi8(v, mask));
+    }
+    return i;
+}
+# endif
+#endif // R3D_X86
+
+#if (R3D_NEON + 0)
+static size_t ByteSwap32_NEON(uint8_t* p, size_t count)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, p += 16)
+        vst1q_u8(p, vrev32q_u8(vld1q_u8(p)));
+    return i;
+}
+#endif
+
+void ByteSwap32(void* data, size_t count)
+{
+    auto p = (uint8_t*)data;
+    size_t done = 0;
+#if (R3D_AVX2 + 0)
+    if (HasAVX2())
+        done = ByteSwap32_AVX2(p, count);
+#endif
+#if (R3D_X86 + 0)
+    done += ByteSwap32_SSE2(p + done * 4, count - done);
+#elif (R3D_NEON + 0)
+    done = ByteSwap32_NEON(p, count);
+#endif
+    ByteSwap32_C(p + done * 4, count - done);
+}
+
+void AudioBufferPool::reset(size_t capacity, uint16_t alignment, size_t count)
+{
+    capacity_ = capacity;
+    alignment_ = alignment;
+    next_ = 0;
+    slots_.clear();
+    slots_.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+        slots_.push_back(make_shared<Slot>(capacity, alignment));
+    lease_.reset(capacity * count);
+}
+
+shared_ptr<AudioBuffer> AudioBufferPool::acquire()
+{
+    shared_ptr<Slot> slot;
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        auto& s = slots_[(next_ + i) % slots_.size()];
+        if (!s->used.load(memory_order_acquire)) { // released by the last frame, its writes are visible. only this thread marks it used
+            next_ = (next_ + i + 1) % slots_.size();
+            slot = s;
+            break;
+        }
+    }
+    if (!slot) { // renderer holds more blocks than expected, grow
+        slots_.push_back(make_shared<Slot>(capacity_, alignment_));
+        lease_.reset(capacity_ * slots_.size());
+        slot = slots_.back();
+    }
+    slot->used.store(true, memory_order_relaxed);
+    slot->buffer.setSize(slot->buffer.capacity());
+    return shared_ptr<AudioBuffer>(&slot->buffer, [slot](AudioBuffer*) {
+        slot->used.store(false, memory_order_release);
+    });
+}
+
+MDK_NS_END
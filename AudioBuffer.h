@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/Buffer.h"
+#include "base/ByteArray.h"
+#include "MemoryBudget.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+MDK_NS_BEGIN
+
+// swap bytes of count 32bit words in place, e.g. s32be to s32le. data alignment is not required
+void ByteSwap32(void* data, size_t count);
+
+class AudioBuffer final : public Buffer
+{
+public:
+    AudioBuffer(size_t capacity, uint16_t alignment) : data_((int)capacity, alignment), size_(capacity) {}
+    const uint8_t* constData() const override { return data_.constData(); }
+    uint8_t* data() override { return data_.data(); }
+    size_t size() const override { return size_; }
+    size_t capacity() const { return data_.size(); }
+    void setSize(size_t size) { size_ = size; }
+private:
+    ByteArray data_;
+    size_t size_;
+};
+
+// Aligned audio block buffers reused once no AudioFrame references them. No buffer allocation after the renderer queue is full.
+// A buffer is marked in use until the deleter of the last reference releases it, so reuse happens after the renderer's last access.
+// acquire() must be called in a single thread
+class AudioBufferPool
+{
+public:
+    void reset(size_t capacity, uint16_t alignment, size_t count);
+    std::shared_ptr<AudioBuffer> acquire();
+private:
+    struct Slot {
+        Slot(size_t capacity, uint16_t alignment) : buffer(capacity, alignment) {}
+        AudioBuffer buffer;
+        std::atomic<bool> used = false;
+    };
+
+    size_t capacity_ = 0;
+    uint16_t alignment_ = 0;
+    size_t next_ = 0;
+    std::vector<std::shared_ptr<Slot>> slots_; // alive while a frame references it, even after reset()
+    MemoryBudget::Lease lease_;
+};
+
+MDK_NS_END
@@ -0,0 +1,645 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "Convert.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+constexpr int kMinBandRows = 32;
+
+// BT.709 limited range in 16bit: Y in [16, 235]<<8, UV in [16, 240]<<8
+namespace bt709 {
+constexpr float Kr = 0.2126f;
+constexpr float Kb = 0.0722f;
+constexpr float Kg = 1.0f - Kr - Kb;
+constexpr float Ys = 219.0f * 256.0f / 65535.0f;
+constexpr float Cs = 224.0f * 256.0f / 65535.0f;
+constexpr float YR = Ys * Kr, YG = Ys * Kg, YB = Ys * Kb;
+constexpr float UR = -Cs * Kr / (2.0f * (1.0f - Kb)), UG = -Cs * Kg / (2.0f * (1.0f - Kb)), UB = Cs * 0.5f;
+constexpr float VR = Cs * 0.5f, VG = -Cs * Kg / (2.0f * (1.0f - Kr)), VB = -Cs * Kb / (2.0f * (1.0f - Kr));
+constexpr float Y0 = 4096.0f;
+constexpr float C0 = 32768.0f;
+} // namespace bt709
+
+enum class Yuv {
+    P016,
+    P010, // 10bit in msb
+    NV12,
+};
+
+struct Planes {
+    uint8_t* data[4]{};
+    size_t stride[4]{};
+};
+
+struct RgbRow {
+    const uint16_t* r;
+    const uint16_t* g;
+    const uint16_t* b;
+};
+
+// the same layout as FramePool::frame()
+static Planes Layout(const FramePool::Buffer& b)
+{
+    const VideoFormat fmt(b.format);
+    Planes p;
+    auto data = (uint8_t*)b.data.constData();
+    size_t offset = 0;
+    for (int i = 0; i < std::min(fmt.planeCount(), 4); ++i) {
+        p.stride[i] = fmt.bytesPerLine(b.width, i);
+        p.data[i] = data + offset;
+        offset += p.stride[i] * b.height;
+    }
+    return p;
+}
+
+static RgbRow SourceRow(const Planes& p, int y)
+{
+    return {
+        (const uint16_t*)(p.data[0] + p.stride[0] * y),
+        (const uint16_t*)(p.data[1] + p.stride[1] * y),
+        (const uint16_t*)(p.data[2] + p.stride[2] * y),
+    };
+}
+
+RowWorkers::RowWorkers(int threads)
+{
+    for (int i = 1; i < std::clamp(threads, 1, 64); ++i)
+        workers_.emplace_back([this, i]{ loop(i); });
+}
+
+RowWorkers::~RowWorkers()
+{
+    {
+        const lock_guard lock(mtx_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_)
+        t.join();
+}
+
+void RowWorkers::run(int rows, const function<void(int, int)>& f)
+{
+    const int bands = std::clamp(std::min(threads(), rows / kMinBandRows), 1, threads());
+    if (bands == 1) {
+        f(0, rows);
+        return;
+    }
+    const int band = (rows + bands - 1) / bands;
+    {
+        const lock_guard lock(mtx_);
+        f_ = &f;
+        rows_ = rows;
+        band_ = band;
+        pending_ = (rows + band - 1) / band - 1;
+        ++job_;
+    }
+    cv_.notify_all();
+    f(0, band);
+    unique_lock lock(mtx_);
+    done_cv_.wait(lock, [this]{ return pending_ == 0; });
+    f_ = nullptr;
+}
+
+// worker index runs band index of each job if it exists
+void RowWorkers::loop(int index)
+{
+    uint64_t job = 0;
+    unique_lock lock(mtx_);
+    while (true) {
+        cv_.wait(lock, [&]{ return stop_ || job_ != job; });
+        if (stop_)
+            return;
+        job = job_;
+        const auto begin = index * band_;
+        if (begin >= rows_)
+            continue;
+        const auto end = std::min(begin + band_, rows_);
+        const auto f = f_;
+        lock.unlock();
+        (*f)(begin, end);
+        lock.lock();
+        if (--pending_ == 0)
+            done_cv_.notify_one();
+    }
+}
+
+void ParallelRows(int rows, RowWorkers* workers, const function<void(int, int)>& f)
+{
+    if (workers)
+        workers->run(rows, f);
+    else
+        f(0, rows);
+}
+
+static inline void RGBA64_C(RgbRow s, uint8_t* dst, int x, int n)
+{
+    for (; x < n; ++x) {
+        const uint16_t px[4] = {s.r[x], s.g[x], s.b[x], 0xffff};
+        memcpy(dst + x * 8, px, sizeof(px));
+    }
+}
+
+static inline void X2RGB10_C(RgbRow s, uint8_t* dst, int x, int n)
+{
+    for (; x < n; ++x) {
+        const uint32_t px = 3u << 30 | uint32_t(s.r[x] >> 6) << 20 | uint32_t(s.g[x] >> 6) << 10 | uint32_t(s.b[x] >> 6);
+        memcpy(dst + x * 4, &px, sizeof(px));
+    }
+}
+
+static inline uint8_t To8(uint16_t v)
+{
+    return uint8_t(std::min<uint32_t>(v + 128, 0xffff) >> 8);
+}
+
+static inline void BGRX_C(RgbRow s, uint8_t* dst, int x, int n)
+{
+    for (; x < n; ++x) {
+        const uint8_t px[4] = {To8(s.b[x]), To8(s.g[x]), To8(s.r[x]), 0xff};
+        memcpy(dst + x * 4, px, sizeof(px));
+    }
+}
+
+template<Yuv T>
+static inline void Store_C(uint8_t* p, int i, float v)
+{
+    const auto q = (uint32_t)lrintf(v); // always in [4096, 61440]
+    if constexpr (T == Yuv::NV12) {
+        p[i] = uint8_t(std::min<uint32_t>(q + 128, 0xffff) >> 8);
+    } else {
+        const auto u = uint16_t(T == Yuv::P010 ? std::min<uint32_t>(q + 32, 0xffff) & 0xffc0 : q);
+        memcpy(p + i * 2, &u, 2);
+    }
+}
+
+// 2 rows, uv is interleaved
+template<Yuv T>
+static inline void YUV420_C(RgbRow s0, RgbRow s1, uint8_t* y0, uint8_t* y1, uint8_t* uv, int x, int n)
+{
+    using namespace bt709;
+    for (; x < n; x += 2) {
+        const int xs[2] = {x, std::min(x + 1, n - 1)}; // odd width: the last column is duplicated
+        float r = 0, g = 0, b = 0;
+        for (int i = 0; i < 2; ++i) {
+            const int c = xs[i];
+            Store_C<T>(y0, c, Y0 + YR * s0.r[c] + YG * s0.g[c] + YB * s0.b[c]);
+            Store_C<T>(y1, c, Y0 + YR * s1.r[c] + YG * s1.g[c] + YB * s1.b[c]);
+            r += float(s0.r[c] + s1.r[c]);
+            g += float(s0.g[c] + s1.g[c]);
+            b += float(s0.b[c] + s1.b[c]);
+        }
+        r *= 0.25f;
+        g *= 0.25f;
+        b *= 0.25f;
+        Store_C<T>(uv, x, C0 + UR * r + UG * g + UB * b);
+        Store_C<T>(uv, x + 1, C0 + VR * r + VG * g + VB * b);
+    }
+}
+
+#if (R3D_AVX2 + 0)
+R3D_TARGET("avx2") static int RGBA64_AVX2(RgbRow s, uint8_t* dst, int n)
+{
+    const auto a = _mm256_set1_epi16(-1);
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        const auto r = _mm256_loadu_si256((const __m256i*)(s.r + x));
+        const auto g = _mm256_loadu_si256((const __m256i*)(s.g + x));
+        const auto b = _mm256_loadu_si256((const __m256i*)(s.b + x));
+        const auto rg0 = _mm256_unpacklo_epi16(r, g); // pixels 0~3 | 8~11
+        const auto rg1 = _mm256_unpackhi_epi16(r, g); // 4~7 | 12~15
+        const auto ba0 = _mm256_unpacklo_epi16(b, a);
+        const auto ba1 = _mm256_unpackhi_epi16(b, a);
+        const auto p0 = _mm256_unpacklo_epi32(rg0, ba0); // 0, 1 | 8, 9
+        const auto p1 = _mm256_unpackhi_epi32(rg0, ba0); // 2, 3 | 10, 11
+        const auto p2 = _mm256_unpacklo_epi32(rg1, ba1); // 4, 5 | 12, 13
+        const auto p3 = _mm256_unpackhi_epi32(rg1, ba1); // 6, 7 | 14, 15
+        auto d = (__m256i*)(dst + x * 8);
+        _mm256_storeu_si256(d, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(d + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256(d + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256(d + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    return x;
+}
+
+R3D_TARGET("avx2") static int X2RGB10_AVX2(RgbRow s, uint8_t* dst, int n)
+{
+    const auto x2 = _mm256_set1_epi32(int(3u << 30));
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const auto r = _mm256_srli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(s.r + x))), 6);
+        const auto g = _mm256_srli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(s.g + x))), 6);
+        const auto b = _mm256_srli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(s.b + x))), 6);
+        const auto v = _mm256_or_si256(_mm256_or_si256(x2, _mm256_slli_epi32(r, 20)), _mm256_or_si256(_mm256_slli_epi32(g, 10), b));
+        _mm256_storeu_si256((__m256i*)(dst + x * 4), v);
+    }
+    return x;
+}
+
+R3D_TARGET("avx2") static int BGRX_AVX2(RgbRow s, uint8_t* dst, int n)
+{
+    const auto half = _mm256_set1_epi16(128);
+    const auto a = _mm256_set1_epi16(int16_t(0xff00));
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        const auto r = _mm256_srli_epi16(_mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(s.r + x)), half), 8);
+        const auto g = _mm256_srli_epi16(_mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(s.g + x)), half), 8);
+        const auto b = _mm256_srli_epi16(_mm256_adds_epu16(_mm256_loadu_si256((const __m256i*)(s.b + x)), half), 8);
+        const auto bg = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        const auto ra = _mm256_or_si256(r, a);
+        const auto p0 = _mm256_unpacklo_epi16(bg, ra); // pixels 0~3 | 8~11
+        const auto p1 = _mm256_unpackhi_epi16(bg, ra); // 4~7 | 12~15
+        auto d = (__m256i*)(dst + x * 4);
+        _mm256_storeu_si256(d, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(d + 1, _mm256_permute2x128_si256(p0, p1, 0x31));
+    }
+    return x;
+}
+
+// 16 16bit values
+template<Yuv T>
+R3D_TARGET("avx2") static inline void Store_AVX2(uint8_t* p, __m256i v)
+{
+    if constexpr (T == Yuv::P016) {
+        _mm256_storeu_si256((__m256i*)p, v);
+    } else if constexpr (T == Yuv::P010) {
+        v = _mm256_and_si256(_mm256_adds_epu16(v, _mm256_set1_epi16(32)), _mm256_set1_epi16(int16_t(0xffc0)));
+        _mm256_storeu_si256((__m256i*)p, v);
+    } else {
+        v = _mm256_srli_epi16(_mm256_adds_epu16(v, _mm256_set1_epi16(128)), 8);
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(v));
+    }
+}
+
+R3D_TARGET("avx2") static inline __m256i Load8_AVX2(const uint16_t* p)
+{
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+}
+
+R3D_TARGET("avx2") static inline __m256 Dot_AVX2(__m256 r, __m256 g, __m256 b, float kr, float kg, float kb, float k0)
+{
+    const auto v = _mm256_add_ps(_mm256_mul_ps(r, _mm256_set1_ps(kr)), _mm256_mul_ps(g, _mm256_set1_ps(kg)));
+    return _mm256_add_ps(_mm256_add_ps(v, _mm256_mul_ps(b, _mm256_set1_ps(kb))), _mm256_set1_ps(k0));
+}
+
+template<Yuv T>
+R3D_TARGET("avx2") static int YUV420_AVX2(RgbRow s0, RgbRow s1, uint8_t* y0, uint8_t* y1, uint8_t* uv, int n)
+{
+    using namespace bt709;
+    constexpr int Bpp = T == Yuv::NV12 ? 1 : 2;
+    const RgbRow src[] = {s0, s1};
+    uint8_t* const dst[] = {y0, y1};
+    int x = 0;
+    for (; x + 16 <= n; x += 16) {
+        __m256i sum[3][2]; // r, g, b of 2 rows, pixels 0~7, 8~15
+        for (int i = 0; i < 2; ++i) {
+            const auto& s = src[i];
+            __m256i y[2];
+            for (int h = 0; h < 2; ++h) {
+                const auto r = Load8_AVX2(s.r + x + h * 8);
+                const auto g = Load8_AVX2(s.g + x + h * 8);
+                const auto b = Load8_AVX2(s.b + x + h * 8);
+                y[h] = _mm256_cvtps_epi32(Dot_AVX2(_mm256_cvtepi32_ps(r), _mm256_cvtepi32_ps(g), _mm256_cvtepi32_ps(b), YR, YG, YB, Y0));
+                sum[0][h] = i == 0 ? r : _mm256_add_epi32(sum[0][h], r);
+                sum[1][h] = i == 0 ? g : _mm256_add_epi32(sum[1][h], g);
+                sum[2][h] = i == 0 ? b : _mm256_add_epi32(sum[2][h], b);
+            }
+            Store_AVX2<T>(dst[i] + x * Bpp, _mm256_permute4x64_epi64(_mm256_packus_epi32(y[0], y[1]), _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+        __m256 c[3]; // 8 chroma samples
+        for (int k = 0; k < 3; ++k) {
+            const auto pairs = _mm256_permute4x64_epi64(_mm256_hadd_epi32(sum[k][0], sum[k][1]), _MM_SHUFFLE(3, 1, 2, 0));
+            c[k] = _mm256_mul_ps(_mm256_cvtepi32_ps(pairs), _mm256_set1_ps(0.25f));
+        }
+        const auto u = _mm256_cvtps_epi32(Dot_AVX2(c[0], c[1], c[2], UR, UG, UB, C0));
+        const auto v = _mm256_cvtps_epi32(Dot_AVX2(c[0], c[1], c[2], VR, VG, VB, C0));
+        Store_AVX2<T>(uv + x * Bpp, _mm256_or_si256(u, _mm256_slli_epi32(v, 16)));
+    }
+    return x;
+}
+#endif // R3D_AVX2
+
+#if (R3D_NEON64 + 0)
+static int RGBA64_NEON(RgbRow s, uint8_t* dst, int n)
+{
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const uint16x8x4_t v = {{vld1q_u16(s.r + x), vld1q_u16(s.g + x), vld1q_u16(s.b + x), vdupq_n_u16(0xffff)}};
+        vst4q_u16((uint16_t*)(dst + x * 8), v);
+    }
+    return x;
+}
+
+static int X2RGB10_NEON(RgbRow s, uint8_t* dst, int n)
+{
+    const auto x2 = vdupq_n_u32(3u << 30);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const auto r = vshrq_n_u16(vld1q_u16(s.r + x), 6);
+        const auto g = vshrq_n_u16(vld1q_u16(s.g + x), 6);
+        const auto b = vshrq_n_u16(vld1q_u16(s.b + x), 6);
+        const auto lo = vorrq_u32(vorrq_u32(x2, vshlq_n_u32(vmovl_u16(vget_low_u16(r)), 20)), vorrq_u32(vshll_n_u16(vget_low_u16(g), 10), vmovl_u16(vget_low_u16(b))));
+        const auto hi = vorrq_u32(vorrq_u32(x2, vshlq_n_u32(vmovl_high_u16(r), 20)), vorrq_u32(vshll_high_n_u16(g, 10), vmovl_high_u16(b)));
+        vst1q_u32((uint32_t*)(dst + x * 4), lo);
+        vst1q_u32((uint32_t*)(dst + x * 4 + 16), hi);
+    }
+    return x;
+}
+
+static int BGRX_NEON(RgbRow s, uint8_t* dst, int n)
+{
+    const auto half = vdupq_n_u16(128);
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const uint8x8x4_t v = {{
+            vshrn_n_u16(vqaddq_u16(vld1q_u16(s.b + x), half), 8),
+            vshrn_n_u16(vqaddq_u16(vld1q_u16(s.g + x), half), 8),
+            vshrn_n_u16(vqaddq_u16(vld1q_u16(s.r + x), half), 8),
+            vdup_n_u8(0xff),
+        }};
+        vst4_u8(dst + x * 4, v);
+    }
+    return x;
+}
+
+// 8 16bit values
+template<Yuv T>
+static inline void Store_NEON(uint8_t* p, uint16x8_t v)
+{
+    if constexpr (T == Yuv::P016) {
+        vst1q_u16((uint16_t*)p, v);
+    } else if constexpr (T == Yuv::P010) {
+        vst1q_u16((uint16_t*)p, vandq_u16(vqaddq_u16(v, vdupq_n_u16(32)), vdupq_n_u16(0xffc0)));
+    } else {
+        vst1_u8(p, vshrn_n_u16(vqaddq_u16(v, vdupq_n_u16(128)), 8));
+    }
+}
+
+static inline float32x4_t Dot_NEON(float32x4_t r, float32x4_t g, float32x4_t b, float kr, float kg, float kb, float k0)
+{
+    return vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(k0), r, kr), g, kg), b, kb);
+}
+
+template<Yuv T>
+static int YUV420_NEON(RgbRow s0, RgbRow s1, uint8_t* y0, uint8_t* y1, uint8_t* uv, int n)
+{
+    using namespace bt709;
+    constexpr int Bpp = T == Yuv::NV12 ? 1 : 2;
+    const RgbRow src[] = {s0, s1};
+    uint8_t* const dst[] = {y0, y1};
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        uint32x4_t sum[3][2]; // r, g, b of 2 rows, pixels 0~3, 4~7
+        for (int i = 0; i < 2; ++i) {
+            const auto& s = src[i];
+            const auto r = vld1q_u16(s.r + x);
+            const auto g = vld1q_u16(s.g + x);
+            const auto b = vld1q_u16(s.b + x);
+            const uint32x4_t rgb[3][2] = {
+                {vmovl_u16(vget_low_u16(r)), vmovl_high_u16(r)},
+                {vmovl_u16(vget_low_u16(g)), vmovl_high_u16(g)},
+                {vmovl_u16(vget_low_u16(b)), vmovl_high_u16(b)},
+            };
+            uint16x4_t y[2];
+            for (int h = 0; h < 2; ++h) {
+                y[h] = vmovn_u32(vcvtnq_u32_f32(Dot_NEON(vcvtq_f32_u32(rgb[0][h]), vcvtq_f32_u32(rgb[1][h]), vcvtq_f32_u32(rgb[2][h]), YR, YG, YB, Y0)));
+                for (int k = 0; k < 3; ++k)
+                    sum[k][h] = i == 0 ? rgb[k][h] : vaddq_u32(sum[k][h], rgb[k][h]);
+            }
+            Store_NEON<T>(dst[i] + x * Bpp, vcombine_u16(y[0], y[1]));
+        }
+        float32x4_t c[3]; // 4 chroma samples
+        for (int k = 0; k < 3; ++k)
+            c[k] = vmulq_n_f32(vcvtq_f32_u32(vpaddq_u32(sum[k][0], sum[k][1])), 0.25f);
+        const auto u = vcvtnq_u32_f32(Dot_NEON(c[0], c[1], c[2], UR, UG, UB, C0));
+        const auto v = vcvtnq_u32_f32(Dot_NEON(c[0], c[1], c[2], VR, VG, VB, C0));
+        Store_NEON<T>(uv + x * Bpp, vreinterpretq_u16_u32(vorrq_u32(u, vshlq_n_u32(v, 16))));
+    }
+    return x;
+}
+#endif // R3D_NEON64
+
+static void RGBA64(RgbRow s, uint8_t* dst, int n)
+{
+    int x = 0;
+#if (R3D_AVX2 + 0)
+    if (HasAVX2())
+        x = RGBA64_AVX2(s, dst, n);
+#elif (R3D_NEON64 + 0)
+    x = RGBA64_NEON(s, dst, n);
+#endif
+    RGBA64_C(s, dst, x, n);
+}
+
+static void X2RGB10(RgbRow s, uint8_t* dst, int n)
+{
+    int x = 0;
+#if (R3D_AVX2 + 0)
+    if (HasAVX2())
+        x = X2RGB10_AVX2(s, dst, n);
+#elif (R3D_NEON64 + 0)
+    x = X2RGB10_NEON(s, dst, n);
+#endif
+    X2RGB10_C(s, dst, x, n);
+}
+
+static void BGRX(RgbRow s, uint8_t* dst, int n)
+{
+    int x = 0;
+#if (R3D_AVX2 + 0)
+    if (HasAVX2())
+        x = BGRX_AVX2(s, dst, n);
+#elif (R3D_NEON64 + 0)
+    x = BGRX_NEON(s, dst, n);
+#endif
+    BGRX_C(s, dst, x, n);
+}
+
+static void RGBP16(RgbRow s, const Planes& d, int y, int n)
+{
+    memcpy(d.data[0] + d.stride[0] * y, s.r, n * 2);
+    memcpy(d.data[1] + d.stride[1] * y, s.g, n * 2);
+    memcpy(d.data[2] + d.stride[2] * y, s.b, n * 2);
+}
+
+template<Yuv T>
+static void YUV420(RgbRow s0, RgbRow s1, uint8_t* y0, uint8_t* y1, uint8_t* uv, int n)
+{
+    int x = 0;
+#if (R3D_AVX2 + 0)
+    if (HasAVX2())
+        x = YUV420_AVX2<T>(s0, s1, y0, y1, uv, n);
+#elif (R3D_NEON64 + 0)
+    x = YUV420_NEON<T>(s0, s1, y0, y1, uv, n);
+#endif
+    YUV420_C<T>(s0, s1, y0, y1, uv, x, n);
+}
+
+// rows of output size, resampled if size differs. used by 1 thread
+class RowSource
+{
+public:
+    RowSource(const Planes& src, int srcWidth, const FilterTaps* h, const FilterTaps* v, int width)
+        : src_(src), src_width_(srcWidth), h_(h), v_(v), width_(width) {
+        if (!h_)
+            return;
+        tmp_.assign(srcWidth + h_->stride, 0.0f); // FilterH() reads stride weights
+        rows_.resize(v_->taps);
+        for (auto& out : out_)
+            out.resize((size_t)width * 3);
+    }
+
+    // slot: 2 rows can be alive
+    RgbRow row(int y, int slot = 0) {
+        if (!h_)
+            return SourceRow(src_, y);
+        const auto w = &v_->weights[(size_t)y * v_->stride];
+        auto out = out_[slot].data();
+        for (int c = 0; c < 3; ++c) {
+            for (int k = 0; k < v_->taps; ++k)
+                rows_[k] = (const uint16_t*)(src_.data[c] + src_.stride[c] * (v_->start[y] + k));
+            FilterV(rows_.data(), w, v_->taps, tmp_.data(), src_width_);
+            FilterH(tmp_.data(), *h_, out + c * width_, width_);
+        }
+        return {out, out + width_, out + width_ * 2};
+    }
+private:
+    Planes src_;
+    int src_width_;
+    const FilterTaps* h_;
+    const FilterTaps* v_;
+    int width_;
+    vector<float> tmp_; // vertical pass of a plane
+    vector<const uint16_t*> rows_;
+    vector<uint16_t> out_[2];
+};
+
+template<Yuv T, class S>
+static void ConvertYUV420(S&& source, const Planes& d, int w, int h, RowWorkers* workers)
+{
+    // a band is rows of chroma, so luma rows of a band are even
+    ParallelRows((h + 1) / 2, workers, [&](int begin, int end) {
+        auto s = source();
+        for (int cy = begin; cy < end; ++cy) {
+            const int y = cy * 2;
+            const int y1 = std::min(y + 1, h - 1); // odd height: the last row is duplicated
+            YUV420<T>(s.row(y, 0), s.row(y1, 1), d.data[0] + d.stride[0] * y, d.data[0] + d.stride[0] * y1, d.data[1] + d.stride[1] * cy, w);
+        }
+    });
+}
+
+template<class F, class S>
+static void ConvertRows(F f, S&& source, const Planes& d, int w, int h, RowWorkers* workers)
+{
+    ParallelRows(h, workers, [&](int begin, int end) {
+        auto s = source();
+        for (int y = begin; y < end; ++y)
+            f(s.row(y), d.data[0] + d.stride[0] * y, w);
+    });
+}
+
+PixelFormat DecodeFormat(PixelFormat format, bool resize)
+{
+    switch (format) {
+    case PixelFormat::RGBA64:
+    case PixelFormat::X2RGB10:
+    case PixelFormat::P016LE:
+    case PixelFormat::P010LE:
+    case PixelFormat::NV12:
+        return PixelFormat::RGBP16;
+    case PixelFormat::BGRA:
+    case PixelFormat::BGRX:
+        return resize ? PixelFormat::RGBP16 : format;
+    default:
+        return format;
+    }
+}
+
+// taps depend only on sizes and filter, built once for a stream of frames. a few recent ones are kept for all readers
+static shared_ptr<const FilterTaps> Taps(int srcSize, int dstSize, Filter filter)
+{
+    struct Entry {
+        int src;
+        int dst;
+        Filter filter;
+        shared_ptr<const FilterTaps> taps;
+    };
+    constexpr size_t kMaxEntries = 8;
+    static mutex mtx;
+    static vector<Entry> entries; // most recent last
+    const lock_guard lock(mtx);
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->src == srcSize && it->dst == dstSize && it->filter == filter) {
+            auto e = std::move(*it);
+            entries.erase(it);
+            entries.push_back(std::move(e));
+            return entries.back().taps;
+        }
+    }
+    if (entries.size() >= kMaxEntries)
+        entries.erase(entries.begin());
+    entries.push_back({srcSize, dstSize, filter, make_shared<const FilterTaps>(MakeTaps(srcSize, dstSize, filter))});
+    return entries.back().taps;
+}
+
+bool ConvertFrame(const FramePool::Buffer& src, FramePool::Buffer& dst, RowWorkers* workers, Filter filter)
+{
+    const bool resize = src.width != dst.width || src.height != dst.height;
+    if (src.format != PixelFormat::RGBP16 || (resize && filter == Filter::None))
+        return false;
+    const int w = dst.width;
+    const int h = dst.height;
+    if (src.data.size() < VideoFormat(src.format).bytesPerFrame(src.width, src.height) || dst.data.size() < VideoFormat(dst.format).bytesPerFrame(w, h))
+        return false;
+    const auto s = Layout(src);
+    const auto d = Layout(dst);
+    shared_ptr<const FilterTaps> th, tv;
+    if (resize) {
+        th = Taps(src.width, w, filter);
+        tv = Taps(src.height, h, filter);
+    }
+    const auto source = [&] { return RowSource(s, src.width, th.get(), tv.get(), w); };
+    switch (dst.format) {
+    case PixelFormat::RGBA64:
+        ConvertRows(RGBA64, source, d, w, h, workers);
+        return true;
+    case PixelFormat::X2RGB10:
+        ConvertRows(X2RGB10, source, d, w, h, workers);
+        return true;
+    case PixelFormat::BGRA:
+    case PixelFormat::BGRX:
+        ConvertRows(BGRX, source, d, w, h, workers);
+        return true;
+    case PixelFormat::RGBP16:
+        ParallelRows(h, workers, [&](int begin, int end) {
+            auto rs = source();
+            for (int y = begin; y < end; ++y)
+                RGBP16(rs.row(y), d, y, w);
+        });
+        return true;
+    case PixelFormat::P016LE:
+        ConvertYUV420<Yuv::P016>(source, d, w, h, workers);
+        return true;
+    case PixelFormat::P010LE:
+        ConvertYUV420<Yuv::P010>(source, d, w, h, workers);
+        return true;
+    case PixelFormat::NV12:
+        ConvertYUV420<Yuv::NV12>(source, d, w, h, workers);
+        return true;
+    default:
+        return false;
+    }
+}
+
+MDK_NS_END
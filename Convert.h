@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "FramePool.h"
+#include "Resample.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+MDK_NS_BEGIN
+
+// Output formats R3DSDK can not produce are converted from 16bit planar RGB after decoding, in one pass by AVX2/NEON kernels:
+// RGBA64, X2RGB10, and BT.709 limited range P016, P010 and NV12 with 2x2 averaged chroma.
+// Resizing is fused: each output row is resampled into a per thread row, then converted, so source and output are touched once.
+
+// Persistent threads converting row bands of a frame, owned by a reader so a frame does not pay thread creation.
+// run() is called by one thread at a time, the calling thread converts the 1st band
+class RowWorkers
+{
+public:
+    explicit RowWorkers(int threads); // including the calling thread
+    ~RowWorkers();
+    int threads() const { return (int)workers_.size() + 1; }
+    // rows in [0, rows) are split into bands of 32+ rows, f(begin, end) of each band runs on a worker
+    void run(int rows, const std::function<void(int, int)>& f);
+private:
+    void loop(int index);
+
+    std::vector<std::thread> workers_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(int, int)>* f_ = nullptr;
+    int rows_ = 0;
+    int band_ = 0;
+    uint64_t job_ = 0; // increased by run()
+    int pending_ = 0; // workers running bands of current job
+    bool stop_ = false;
+};
+
+// format the SDK decodes to for a requested output format. RGBP16 if conversion is required, otherwise format itself
+// resize: BGRA, BGRX are decoded as RGBP16 too. RGB48, BGR24 and half float can not be resized
+PixelFormat DecodeFormat(PixelFormat format, bool resize = false);
+// convert src to dst, resampled by filter if size differs. planes are laid out as FramePool::frame(). workers: row bands converted in parallel, null: calling thread only
+bool ConvertFrame(const FramePool::Buffer& src, FramePool::Buffer& dst, RowWorkers* workers = nullptr, Filter filter = Filter::Bilinear);
+// f(0, rows) if workers is null, otherwise workers->run()
+void ParallelRows(int rows, RowWorkers* workers, const std::function<void(int, int)>& f);
+
+MDK_NS_END
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "DecoderService.h"
+#include "MemoryBudget.h"
+#include "R3DCxxAbi.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+DecoderService::Ptr DecoderService::get(Kind kind, int gpu)
+{
+    static mutex mtx;
+    static map<pair<int, int>, weak_ptr<DecoderService>> services;
+    const lock_guard lock(mtx);
+    auto& s = services[{kind, kind == R3D ? gpu : 0}];
+    auto p = s.lock();
+    if (!p) {
+        p.reset(new DecoderService(kind, gpu));
+        if (!p->open())
+            return nullptr;
+        s = p;
+    }
+    // a reader's own reference, the service is closed after all of them are released
+    p->readers_++;
+    return Ptr(p.get(), [p](DecoderService* d) { d->readers_--; });
+}
+
+DecoderService::~DecoderService()
+{
+    if (async_)
+        async_->Close();
+    if (gpu_)
+        gpu_->Close();
+    if (r3d_)
+        R3DSDK::R3DDecoder::ReleaseDecoder(r3d_); // FIXME: may block here
+}
+
+int DecoderService::quota() const
+{
+    return std::max<int>(1, capacity_ / std::max<int>(1, readers_));
+}
+
+bool DecoderService::acquire(int own, bool force)
+{
+    if (own <= 0 || force) {
+        inflight_++;
+        return true;
+    }
+    auto n = inflight_.load();
+    while (n < capacity_) {
+        if (inflight_.compare_exchange_weak(n, n + 1))
+            return true;
+    }
+    return false;
+}
+
+void DecoderService::release(int n)
+{
+    inflight_ -= n;
+}
+
+bool DecoderService::open()
+{
+    capacity_ = std::max(GlobalOption("R3D_DECODE_CONCURRENCY", capacity_), 1);
+    if (kind_ == Gpu) {
+        gpu_ = make_unique<R3DSDK::GpuDecoder>();
+        gpu_->Open();
+        return true;
+    }
+    if (kind_ == Async) {
+        async_ = make_unique<R3DSDK::AsyncDecoder>();
+        async_->Open();
+        return true;
+    }
+    R3DSDK::R3DDecoderOptions *options = nullptr;
+    R3DSDK::R3DStatus status = R3DSDK::R3DDecoderOptions::CreateOptions(&options);
+    if (status != R3DSDK::R3DStatus_Ok) {
+        clog << "R3DDecoderOptions::CreateOptions error: " << status << endl;
+        return false;
+    }
+    // one pool for all readers, a part of host memory budget by default
+    const auto pool = (int)std::clamp<size_t>(MemoryBudget::instance().capacity() / 4 >> 20, 1024, 4096);
+    options->setMemoryPoolSize(std::max(GlobalOption("R3D_MEMORY_POOL", pool), 1024));        // 1024+
+    options->setGPUMemoryPoolSize(std::max(GlobalOption("R3D_GPU_MEMORY_POOL", 4096), 1024)); // 1024+
+    options->setGPUConcurrentFrameCount(std::clamp(capacity_, 1, 3)); // 1~3
+    //options->setScratchFolder("");            //empty string disables scratch folder. c++ abi
+    options->setDecompressionThreadCount(0);    //cores - 1 is good if you are a gui based app.
+    options->setConcurrentImageCount(0);        //threads to process images/manage state of image processing.
+    //options->useRRXAsync(true); // removed in 8.6
+
+    status = SetupCudaCLDevices(options, gpu_runtime_);
+    if (status != R3DSDK::R3DStatus_Ok) {
+        clog << "Setup Cuda/OpenCL Devices error: " << status << endl;
+        R3DSDK::R3DDecoderOptions::ReleaseOptions(options);
+        return false;
+    }
+
+    status = R3DSDK::R3DDecoder::CreateDecoder(options, &r3d_);
+
+    R3DSDK::R3DDecoderOptions::ReleaseOptions(options);
+    if (status != R3DSDK::R3DStatus_Ok) {
+        clog << "R3DDecoder::CreateDecoder error: " << status << endl;
+        r3d_ = nullptr;
+        return false;
+    }
+    return true;
+}
+
+MDK_NS_END
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/global.h"
+#include "R3DSDK.h"
+#include "R3DSDKDecoder.h"
+#include <atomic>
+#include <memory>
+
+MDK_NS_BEGIN
+
+// A process-wide R3DDecoder, AsyncDecoder or GpuDecoder shared by all readers, closed with the last reader.
+// Memory pools are configured once by global options in MB: "R3D_MEMORY_POOL"(default is from MemoryBudget) and "R3D_GPU_MEMORY_POOL".
+// "R3D_DECODE_CONCURRENCY" bounds decodes in flight of all readers. a reader takes at most an even split of it, so it can not starve others,
+// and can always have 1 decode in flight, so the total exceeds the capacity only by readers beyond it.
+// A reader must wait for its own jobs before releasing the service, the decoder is not closed by a reader.
+class DecoderService
+{
+public:
+    enum Kind {
+        R3D,
+        Async,
+        Gpu,
+    };
+    using Ptr = std::shared_ptr<DecoderService>;
+
+    // gpu: OPTION_RED_* for R3DDecoder, a decoder of a different gpu runtime is not shared. nullptr if failed
+    // a reader holds the returned pointer until unload, it's counted in quota() until released
+    static Ptr get(Kind kind, int gpu = 0);
+    ~DecoderService();
+
+    R3DSDK::R3DDecoder* r3d() const { return r3d_; }
+    R3DSDK::AsyncDecoder* async() const { return async_.get(); }
+    R3DSDK::GpuDecoder* gpu() const { return gpu_.get(); }
+    // max decodes in flight of a reader
+    int quota() const;
+    // a decode of a reader with own decodes in flight can start. false if the service is full and the reader has one already
+    // force: seek target, not waiting for decodes of old positions
+    bool acquire(int own, bool force = false);
+    // decodes completed or not submitted
+    void release(int n = 1);
+private:
+    DecoderService(Kind kind, int gpu) : kind_(kind), gpu_runtime_(gpu) {}
+    bool open();
+
+    Kind kind_;
+    int gpu_runtime_;
+    int capacity_ = 8;
+    std::atomic<int> readers_ = 0; // pointers returned by get() and not released
+    std::atomic<int> inflight_ = 0; // decodes of all readers
+    R3DSDK::R3DDecoder* r3d_ = nullptr;
+    std::unique_ptr<R3DSDK::AsyncDecoder> async_;
+    std::unique_ptr<R3DSDK::GpuDecoder> gpu_;
+};
+
+MDK_NS_END
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "FrameCache.h"
+#include "base/Hash.h"
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+size_t FrameCache::KeyHash::operator()(const Key& k) const
+{
+    auto h = detail::fnv1ah64::hash((const char*)&k.index, sizeof(k.index), k.settings);
+    h = detail::fnv1ah64::hash((const char*)&k.mode, sizeof(k.mode), h);
+    return (size_t)detail::fnv1ah64::hash((const char*)&k.format, sizeof(k.format), h);
+}
+
+void FrameCache::setCapacity(size_t bytes)
+{
+    const lock_guard lock(mtx_);
+    capacity_ = bytes;
+    evict(capacity_);
+}
+
+size_t FrameCache::capacity() const
+{
+    const lock_guard lock(mtx_);
+    return capacity_;
+}
+
+size_t FrameCache::size() const
+{
+    const lock_guard lock(mtx_);
+    return bytes_;
+}
+
+VideoFrame FrameCache::get(const Key& key)
+{
+    const lock_guard lock(mtx_);
+    const auto it = map_.find(key);
+    if (it == map_.end())
+        return {};
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->frame;
+}
+
+void FrameCache::put(const Key& key, const VideoFrame& frame, size_t bytes)
+{
+    const lock_guard lock(mtx_);
+    if (bytes == 0 || bytes > capacity_)
+        return;
+    if (const auto it = map_.find(key); it != map_.end()) {
+        bytes_ -= it->second->bytes;
+        lru_.erase(it->second);
+        map_.erase(it);
+    }
+    evict(capacity_ - bytes);
+    lru_.push_front(Entry{key, frame, bytes});
+    map_.emplace(key, lru_.begin());
+    bytes_ += bytes;
+}
+
+void FrameCache::clear()
+{
+    const lock_guard lock(mtx_);
+    evict(0);
+}
+
+void FrameCache::evict(size_t capacity)
+{
+    while (bytes_ > capacity && !lru_.empty()) {
+        auto& e = lru_.back();
+        bytes_ -= e.bytes;
+        map_.erase(e.key);
+        lru_.pop_back();
+    }
+}
+
+MDK_NS_END
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/VideoFrame.h"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+MDK_NS_BEGIN
+
+// Recently delivered frames for frame stepping and scrubbing. Least recently used frames are evicted when the total size exceeds capacity.
+// A cached frame shares memory with the delivered frame, e.g. a FramePool buffer, so nothing is copied.
+class FrameCache
+{
+public:
+    struct Key {
+        uint64_t index = 0;
+        int mode = 0; // R3DSDK::VideoDecodeMode
+        PixelFormat format = PixelFormat::Unknown;
+        uint64_t settings = 0; // ImageProcessingSettings hash
+
+        bool operator==(const Key&) const = default;
+    };
+
+    // 0: disabled
+    void setCapacity(size_t bytes);
+    size_t capacity() const;
+    size_t size() const; // bytes
+    // an invalid frame if not found
+    VideoFrame get(const Key& key);
+    void put(const Key& key, const VideoFrame& frame, size_t bytes);
+    void clear();
+private:
+    struct KeyHash {
+        size_t operator()(const Key& k) const;
+    };
+    struct Entry {
+        Key key;
+        VideoFrame frame;
+        size_t bytes;
+    };
+    using List = std::list<Entry>;
+
+    void evict(size_t capacity);
+
+    size_t capacity_ = 0;
+    size_t bytes_ = 0;
+    List lru_; // most recently used first
+    std::unordered_map<Key, List::iterator, KeyHash> map_;
+    mutable std::mutex mtx_;
+};
+
+MDK_NS_END
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "FramePool.h"
+#include "MemoryBudget.h"
+#include "mdk/VideoBuffer.h"
+#include "mdk/VideoFormat.h"
+#include <iostream>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+constexpr auto kBudgetPoll = chrono::milliseconds(20); // memory may be released by other readers
+
+static void Destroy(FramePool::Buffer* b)
+{
+    MemoryBudget::instance().release(b->data.size());
+    delete b;
+}
+
+class PooledVideoBuffer final : public NativeVideoBuffer
+{
+public:
+    PooledVideoBuffer(FramePool::BufferRef buf, int width, int height, PixelFormat format, int planes, const int* strides, const size_t* offsets)
+        : buf_(std::move(buf)), width_(width), height_(height), format_(format), planes_(planes) {
+        for (int i = 0; i < planes_; ++i) {
+            stride_[i] = strides[i];
+            ma_.data[i] = buf_->data.constData() + offsets[i];
+        }
+    }
+
+    void* map(Type type, MapParameter* mp) override {
+        if (type != HostMemory)
+            return nullptr;
+        mp->format = format_;
+        for (int i = 0; i < planes_; ++i) {
+            mp->width[i] = width_;
+            mp->height[i] = height_;
+            mp->stride[i] = stride_[i];
+        }
+        return &ma_;
+    }
+private:
+    FramePool::BufferRef buf_; // back to pool when the last frame referencing this is destroyed
+    int width_;
+    int height_;
+    PixelFormat format_;
+    int planes_;
+    int stride_[4]{};
+    MemoryArray ma_{};
+};
+
+void FramePool::reset(int width, int height, PixelFormat format)
+{
+    const lock_guard lock(mtx_);
+    cleared_ = false;
+    if (width == width_ && height == height_ && format == format_)
+        return;
+    width_ = width;
+    height_ = height;
+    format_ = format;
+    bytes_ = VideoFormat(format).bytesPerFrame(width, height);
+    generation_++;
+    allocated_ = 0;
+    for (auto b : free_)
+        Destroy(b);
+    free_.clear();
+    cv_.notify_all();
+}
+
+void FramePool::setBudget(size_t minCount, size_t maxCount)
+{
+    const lock_guard lock(mtx_);
+    min_ = minCount;
+    max_ = std::max(minCount, maxCount);
+    while (allocated_ > max_ && !free_.empty()) {
+        Destroy(free_.back());
+        free_.pop_back();
+        allocated_--;
+    }
+    while (allocated_ < min_ && bytes_ > 0) {
+        MemoryBudget::instance().charge(bytes_);
+        auto b = new Buffer{ByteArray((int)bytes_), generation_, width_, height_, format_};
+        free_.push_back(b);
+        allocated_++;
+    }
+}
+
+FramePool::BufferRef FramePool::acquire(chrono::milliseconds timeout)
+{
+    unique_lock lock(mtx_);
+    const auto deadline = chrono::steady_clock::now() + timeout;
+    while (!cleared_ && bytes_ > 0) {
+        if (!free_.empty()) {
+            auto b = free_.back();
+            free_.pop_back();
+            return lease(b);
+        }
+        if (allocated_ < max_ && charge()) {
+            allocated_++;
+            auto b = new Buffer{ByteArray(), generation_, width_, height_, format_};
+            const auto bytes = bytes_;
+            lock.unlock(); // large frames, do not block recycle()
+            b->data = ByteArray((int)bytes);
+            return lease(b);
+        }
+        if (cv_.wait_until(lock, std::min(deadline, chrono::steady_clock::now() + kBudgetPoll)) == cv_status::timeout
+            && chrono::steady_clock::now() >= deadline) {
+            clog << "R3D no free frame buffer in " << timeout.count() << "ms. in use: " << allocated_ << endl;
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+void FramePool::clear()
+{
+    const lock_guard lock(mtx_);
+    cleared_ = true;
+    allocated_ -= free_.size();
+    for (auto b : free_)
+        Destroy(b);
+    free_.clear();
+    cv_.notify_all();
+}
+
+VideoFrame FramePool::frame(const BufferRef& buf) const
+{
+    if (!buf)
+        return {};
+    const auto width = buf->width;
+    const auto height = buf->height;
+    const auto format = buf->format;
+    const VideoFormat fmt(format);
+    const int planes = std::min(fmt.planeCount(), 4);
+    int strides[4]{};
+    size_t offsets[4]{};
+    size_t offset = 0;
+    for (int i = 0; i < planes; ++i) {
+        strides[i] = fmt.bytesPerLine(width, i);
+        offsets[i] = offset;
+        offset += (size_t)strides[i] * height;
+    }
+    VideoFrame f(width, height, format);
+    f.setNativeBuffer(make_shared<PooledVideoBuffer>(buf, width, height, format, planes, strides, offsets));
+    return f;
+}
+
+size_t FramePool::bytesPerLine(int plane) const
+{
+    const lock_guard lock(mtx_);
+    return VideoFormat(format_).bytesPerLine(width_, plane);
+}
+
+size_t FramePool::inUse() const
+{
+    const lock_guard lock(mtx_);
+    return allocated_ - free_.size();
+}
+
+bool FramePool::charge()
+{
+    auto& budget = MemoryBudget::instance();
+    if (allocated_ >= min_) // grow only if budget allows
+        return budget.tryCharge(bytes_);
+    budget.charge(bytes_);
+    return true;
+}
+
+FramePool::BufferRef FramePool::lease(Buffer* b)
+{
+    return BufferRef(b, [wp = weak_from_this()](Buffer* b) {
+        if (auto pool = wp.lock())
+            pool->recycle(b);
+        else
+            Destroy(b);
+    });
+}
+
+void FramePool::recycle(Buffer* b)
+{
+    unique_lock lock(mtx_);
+    if (b->generation != generation_) { // size or format changed, not counted in allocated_
+        lock.unlock();
+        Destroy(b);
+        return;
+    }
+    // shrink to min_ if memory is tight
+    if (cleared_ || allocated_ > max_ || (allocated_ > min_ && MemoryBudget::instance().pressure())) {
+        allocated_--;
+        lock.unlock();
+        Destroy(b);
+        return;
+    }
+    free_.push_back(b);
+    cv_.notify_one();
+}
+
+MDK_NS_END
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/VideoFrame.h"
+#include "base/ByteArray.h"
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+MDK_NS_BEGIN
+
+// Host memory for decoded frames. A buffer is leased to a decode job, then wrapped by VideoFrame(s) without copy,
+// and goes back to the free list when the last reference is dropped, so the decoder never writes a buffer the renderer still holds.
+// Buffers are charged to MemoryBudget. minCount buffers are always allocated, more only if budget allows, and are released under memory pressure.
+class FramePool final : public std::enable_shared_from_this<FramePool>
+{
+public:
+    struct Buffer {
+        ByteArray data;
+        uint32_t generation = 0;
+        int width = 0; // size and format when allocated
+        int height = 0;
+        PixelFormat format = PixelFormat::Unknown;
+    };
+    using BufferRef = std::shared_ptr<Buffer>;
+    using Ptr = std::shared_ptr<FramePool>;
+
+    static Ptr create() { return Ptr(new FramePool()); }
+
+    // free buffers are released if size or format changed. buffers in use are released when returned
+    void reset(int width, int height, PixelFormat format);
+    // preallocate minCount buffers, grow to at most maxCount when all are in use
+    void setBudget(size_t minCount, size_t maxCount);
+    // a free buffer, or a new one if budget allows, or wait for one. nullptr if timeout or clear()
+    BufferRef acquire(std::chrono::milliseconds timeout);
+    // wakes up acquire() and releases free buffers
+    void clear();
+
+    // wrap buf as a frame of the size and format it was allocated for
+    VideoFrame frame(const BufferRef& buf) const;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    PixelFormat format() const { return format_; }
+    size_t bytesPerFrame() const { return bytes_; }
+    size_t bytesPerLine(int plane = 0) const;
+    size_t inUse() const;
+private:
+    FramePool() = default;
+    bool charge(); // MemoryBudget for a new buffer
+    BufferRef lease(Buffer* b);
+    void recycle(Buffer* b);
+
+    int width_ = 0;
+    int height_ = 0;
+    PixelFormat format_ = PixelFormat::Unknown;
+    size_t bytes_ = 0;
+    size_t min_ = 8;
+    size_t max_ = 16;
+    size_t allocated_ = 0; // current generation, free + in use
+    uint32_t generation_ = 0;
+    bool cleared_ = false;
+    std::vector<Buffer*> free_;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+MDK_NS_END
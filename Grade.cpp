@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "Grade.h"
+#include "Convert.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+constexpr int kMaxLutSize = 256;
+constexpr float kLumaR = 0.2126f; // Rec.709
+constexpr float kLumaG = 0.7152f;
+constexpr float kLumaB = 0.0722f;
+
+static float HalfToFloat(uint16_t h)
+{
+    const uint32_t s = uint32_t(h & 0x8000) << 16;
+    const uint32_t e = (h >> 10) & 0x1f;
+    const uint32_t m = h & 0x3ff;
+    if (e == 0) { // zero or subnormal
+        const auto v = float(m) * (1.0f / 16777216.0f);
+        return s ? -v : v;
+    }
+    const uint32_t f = s | (e == 31 ? 0x7f800000u | m << 13 : (e + 112) << 23 | m << 13);
+    float v;
+    memcpy(&v, &f, sizeof(v));
+    return v;
+}
+
+static uint16_t FloatToHalf(float v)
+{
+    uint32_t f;
+    memcpy(&f, &v, sizeof(f));
+    const auto s = uint16_t((f >> 16) & 0x8000);
+    const uint32_t a = f & 0x7fffffff;
+    if (a > 0x7f800000u) // nan
+        return s | 0x7e00;
+    if (a >= 0x477ff000u) // rounded to inf
+        return s | 0x7c00;
+    if (a < 0x38800000u) // subnormal
+        return s | (uint16_t)lrintf(fabs(v) * 16777216.0f);
+    return s | uint16_t((a - 0x38000000u + 0x0fff + ((a >> 13) & 1)) >> 13); // round to nearest even
+}
+
+// not lrintf(), which is a libm call
+static inline uint16_t To16(float v)
+{
+    return (uint16_t)(std::clamp(v, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+static inline uint8_t To8(float v)
+{
+    return (uint8_t)(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+bool Cdl::identity() const
+{
+    for (int i = 0; i < 3; ++i) {
+        if (slope[i] != 1.0f || offset[i] != 0.0f || power[i] != 1.0f)
+            return false;
+    }
+    return saturation == 1.0f;
+}
+
+bool Cdl::parse(string_view s)
+{
+    *this = {};
+    if (s.empty() || s == "0")
+        return true;
+    float v[10];
+    string str(s);
+    const char* p = str.data();
+    for (auto& x : v) {
+        while (*p == ' ' || *p == ',' || *p == ';')
+            ++p;
+        char* e = nullptr;
+        x = strtof(p, &e);
+        if (e == p)
+            return false;
+        p = e;
+    }
+    for (int i = 0; i < 3; ++i) {
+        slope[i] = v[i];
+        offset[i] = v[3 + i];
+        power[i] = std::max(v[6 + i], 0.0f);
+    }
+    saturation = std::max(v[9], 0.0f);
+    return true;
+}
+
+Lut3D::Ptr Lut3D::load(const string& path)
+{
+    ifstream f(path);
+    if (!f) {
+        clog << "R3D failed to open LUT " << path << endl;
+        return nullptr;
+    }
+    auto lut = make_shared<Lut3D>();
+    float max[3] = {1.0f, 1.0f, 1.0f};
+    size_t count = 0;
+    string line;
+    while (getline(f, line)) {
+        if (const auto c = line.find('#'); c != string::npos)
+            line.resize(c);
+        istringstream ss(line);
+        string key;
+        if (!(ss >> key))
+            continue;
+        if (key == "TITLE")
+            continue;
+        if (key == "LUT_3D_SIZE") {
+            ss >> lut->size_;
+            if (lut->size_ < 2 || lut->size_ > kMaxLutSize) {
+                clog << "R3D invalid LUT_3D_SIZE " << lut->size_ << ": " << path << endl;
+                return nullptr;
+            }
+            lut->rgbx_.assign((size_t)lut->size_ * lut->size_ * lut->size_ * 4, 0.0f);
+        } else if (key == "LUT_1D_SIZE") {
+            clog << "R3D 1D LUT is not supported: " << path << endl;
+            return nullptr;
+        } else if (key == "DOMAIN_MIN") {
+            ss >> lut->min_[0] >> lut->min_[1] >> lut->min_[2];
+        } else if (key == "DOMAIN_MAX") {
+            ss >> max[0] >> max[1] >> max[2];
+        } else if (key == "LUT_3D_INPUT_RANGE") {
+            ss >> lut->min_[0] >> max[0];
+            lut->min_[1] = lut->min_[2] = lut->min_[0];
+            max[1] = max[2] = max[0];
+        } else if (isdigit((unsigned char)key[0]) || key[0] == '-' || key[0] == '.') {
+            if (count * 4 >= lut->rgbx_.size()) {
+                clog << "R3D LUT data without LUT_3D_SIZE or too many entries: " << path << endl;
+                return nullptr;
+            }
+            auto v = &lut->rgbx_[count * 4];
+            v[0] = strtof(key.data(), nullptr);
+            if (!(ss >> v[1] >> v[2])) {
+                clog << "R3D invalid LUT entry '" << line << "': " << path << endl;
+                return nullptr;
+            }
+            ++count;
+        } // other keywords are ignored
+    }
+    if (count == 0 || count * 4 != lut->rgbx_.size()) {
+        clog << "R3D LUT has " << count << " entries, expect " << lut->rgbx_.size() / 4 << ": " << path << endl;
+        return nullptr;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (max[i] <= lut->min_[i]) {
+            clog << "R3D invalid LUT domain: " << path << endl;
+            return nullptr;
+        }
+        lut->scale_[i] = float(lut->size_ - 1) / (max[i] - lut->min_[i]);
+    }
+    clog << "R3D LUT " << lut->size_ << "^3: " << path << endl;
+    return lut;
+}
+
+void Lut3D::sample(const float* in, float* out) const
+{
+    const int n = size_;
+    int i[3];
+    float f[3];
+    for (int c = 0; c < 3; ++c) {
+        auto v = (in[c] - min_[c]) * scale_[c];
+        v = v > 0.0f ? std::min(v, float(n - 1)) : 0.0f; // nan is 0
+        i[c] = std::min((int)v, n - 2);
+        f[c] = v - float(i[c]);
+    }
+    const int d[3] = {1, n, n * n};
+    const int base = i[0] + i[1] * d[1] + i[2] * d[2];
+    // the tetrahedron from vertex 000 to 111 along axes of decreasing fractions
+    int a0 = 0, a1 = 1, a2 = 2;
+    if (f[a0] < f[a1])
+        swap(a0, a1);
+    if (f[a1] < f[a2])
+        swap(a1, a2);
+    if (f[a0] < f[a1])
+        swap(a0, a1);
+    const float w[4] = {1.0f - f[a0], f[a0] - f[a1], f[a1] - f[a2], f[a2]};
+    const float* v[4];
+    v[0] = &rgbx_[(size_t)base * 4];
+    v[1] = v[0] + d[a0] * 4;
+    v[2] = v[1] + d[a1] * 4;
+    v[3] = v[0] + (d[0] + d[1] + d[2]) * 4;
+#if (R3D_X86 + 0)
+    auto c = _mm_mul_ps(_mm_loadu_ps(v[0]), _mm_set1_ps(w[0]));
+    for (int k = 1; k < 4; ++k)
+        c = _mm_add_ps(c, _mm_mul_ps(_mm_loadu_ps(v[k]), _mm_set1_ps(w[k])));
+    alignas(16) float rgbx[4];
+    _mm_store_ps(rgbx, c);
+    memcpy(out, rgbx, 3 * sizeof(float));
+#elif (R3D_NEON + 0)
+    auto c = vmulq_n_f32(vld1q_f32(v[0]), w[0]);
+    for (int k = 1; k < 4; ++k)
+        c = vmlaq_n_f32(c, vld1q_f32(v[k]), w[k]);
+    float rgbx[4];
+    vst1q_f32(rgbx, c);
+    memcpy(out, rgbx, 3 * sizeof(float));
+#else
+    for (int c = 0; c < 3; ++c)
+        out[c] = w[0] * v[0][c] + w[1] * v[1][c] + w[2] * v[2][c] + w[3] * v[3][c];
+#endif
+}
+
+// pixel access of a row, read from data and written to dst of the same layout. kInt: values are 16bit, 8bit values are scaled by 257
+namespace {
+struct Planar16 {
+    static constexpr bool kInt = true;
+    const uint8_t* data[3];
+    uint8_t* dst[3];
+    size_t stride;
+    int width;
+    const uint16_t* p[3]{};
+    uint16_t* q[3]{};
+
+    void row(int y) {
+        for (int c = 0; c < 3; ++c) {
+            p[c] = (const uint16_t*)(data[c] + stride * y);
+            q[c] = (uint16_t*)(dst[c] + stride * y);
+        }
+    }
+    void get(int x, uint16_t* v) const {
+        for (int c = 0; c < 3; ++c)
+            v[c] = p[c][x];
+    }
+    void set(int x, const float* rgb) {
+        for (int c = 0; c < 3; ++c)
+            q[c][x] = To16(rgb[c]);
+    }
+    const uint16_t* const* planes(int x) {
+        for (int c = 0; c < 3; ++c)
+            block[c] = p[c] + x;
+        return block;
+    }
+    uint16_t* const* outPlanes(int x) {
+        for (int c = 0; c < 3; ++c)
+            out[c] = q[c] + x;
+        return out;
+    }
+    void flush(int) {}
+    const uint16_t* block[3]{};
+    uint16_t* out[3]{};
+};
+
+// 8 packed pixels are deinterleaved to planes for Grade::block8()
+template<class Io>
+struct Blocks {
+    const uint16_t* const* planes(int x) {
+        auto& io = static_cast<Io&>(*this);
+        for (int i = 0; i < 8; ++i) {
+            uint16_t px[3];
+            io.get(x + i, px);
+            for (int c = 0; c < 3; ++c)
+                v[c][i] = px[c];
+        }
+        for (int c = 0; c < 3; ++c)
+            block[c] = v[c];
+        return block;
+    }
+    uint16_t* const* outPlanes(int) { return block; } // in place, then flush()
+    void flush(int x) {
+        auto& io = static_cast<Io&>(*this);
+        for (int i = 0; i < 8; ++i) {
+            const uint16_t px[3] = {v[0][i], v[1][i], v[2][i]};
+            io.put(x + i, px);
+        }
+    }
+    uint16_t v[3][8];
+    uint16_t* block[3];
+};
+
+struct Packed16 : Blocks<Packed16> {
+    static constexpr bool kInt = true;
+    const uint8_t* data;
+    uint8_t* dst;
+    size_t stride;
+    int width;
+    const uint16_t* p = nullptr;
+    uint16_t* q = nullptr;
+
+    void row(int y) {
+        p = (const uint16_t*)(data + stride * y);
+        q = (uint16_t*)(dst + stride * y);
+    }
+    void get(int x, uint16_t* v) const { memcpy(v, p + x * 3, 3 * sizeof(uint16_t)); }
+    void put(int x, const uint16_t* v) { memcpy(q + x * 3, v, 3 * sizeof(uint16_t)); }
+    void set(int x, const float* rgb) {
+        for (int c = 0; c < 3; ++c)
+            q[x * 3 + c] = To16(rgb[c]);
+    }
+};
+
+struct Bgra8 : Blocks<Bgra8> {
+    static constexpr bool kInt = true;
+    const uint8_t* data;
+    uint8_t* dst;
+    size_t stride;
+    int width;
+    const uint8_t* p = nullptr;
+    uint8_t* q = nullptr;
+
+    void row(int y) {
+        p = data + stride * y;
+        q = dst + stride * y;
+        if (q != p) // alpha or padding
+            memcpy(q, p, (size_t)width * 4);
+    }
+    void get(int x, uint16_t* v) const {
+        for (int c = 0; c < 3; ++c)
+            v[c] = p[x * 4 + 2 - c] * 257;
+    }
+    void put(int x, const uint16_t* v) {
+        for (int c = 0; c < 3; ++c)
+            q[x * 4 + 2 - c] = uint8_t((v[c] * 255u + 32767u) / 65535u);
+    }
+    void set(int x, const float* rgb) {
+        for (int c = 0; c < 3; ++c)
+            q[x * 4 + 2 - c] = To8(rgb[c]);
+    }
+};
+
+struct PackedHalf {
+    static constexpr bool kInt = false;
+    const uint8_t* data;
+    uint8_t* dst;
+    size_t stride;
+    int width;
+    const uint16_t* p = nullptr;
+    uint16_t* q = nullptr;
+
+    void row(int y) {
+        p = (const uint16_t*)(data + stride * y);
+        q = (uint16_t*)(dst + stride * y);
+    }
+    void get(int x, float* rgb) const {
+        for (int c = 0; c < 3; ++c)
+            rgb[c] = HalfToFloat(p[x * 3 + c]);
+    }
+    void set(int x, const float* rgb) {
+        for (int c = 0; c < 3; ++c)
+            q[x * 3 + c] = FloatToHalf(rgb[c]);
+    }
+};
+} // namespace
+
+static float Sop(const Cdl& cdl, int c, float v, bool clamp)
+{
+    v = v * cdl.slope[c] + cdl.offset[c];
+    v = clamp ? std::clamp(v, 0.0f, 1.0f) : std::max(v, 0.0f);
+    return cdl.power[c] == 1.0f ? v : pow(v, cdl.power[c]);
+}
+
+Grade::Ptr Grade::create(const Cdl& cdl, Lut3D::Ptr lut)
+{
+    if (cdl.identity() && !lut)
+        return nullptr;
+    auto g = new Grade();
+    g->cdl_ = cdl;
+    g->lut_ = std::move(lut);
+    for (int c = 0; c < 3; ++c)
+        g->sop_ |= cdl.slope[c] != 1.0f || cdl.offset[c] != 0.0f || cdl.power[c] != 1.0f;
+    if (g->sop_) {
+        g->curve_.resize(3 * 65536);
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < 65536; ++i)
+                g->curve_[c * 65536 + i] = Sop(cdl, c, float(i) / 65535.0f, true);
+        }
+    }
+    return Ptr(g);
+}
+
+bool Grade::supports(PixelFormat format)
+{
+    switch (format) {
+    case PixelFormat::RGBP16:
+    case PixelFormat::RGB48:
+    case PixelFormat::RGBF16:
+    case PixelFormat::BGRA:
+    case PixelFormat::BGRX:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void Grade::finish(float* rgb, bool clamp) const
+{
+    if (cdl_.saturation != 1.0f) {
+        const auto l = kLumaR * rgb[0] + kLumaG * rgb[1] + kLumaB * rgb[2];
+        for (int c = 0; c < 3; ++c) {
+            rgb[c] = l + cdl_.saturation * (rgb[c] - l);
+            if (clamp)
+                rgb[c] = std::clamp(rgb[c], 0.0f, 1.0f);
+        }
+    }
+    if (lut_)
+        lut_->sample(rgb, rgb);
+}
+
+void Grade::pixel(float* rgb, bool clamp) const
+{
+    if (sop_) {
+        for (int c = 0; c < 3; ++c)
+            rgb[c] = Sop(cdl_, c, rgb[c], clamp);
+    }
+    finish(rgb, clamp);
+}
+
+#if (R3D_AVX2 + 0)
+R3D_TARGET("avx2") void Grade::block8(const uint16_t* const* in, uint16_t* const* out) const
+{
+    const auto zero = _mm256_setzero_ps();
+    const auto one = _mm256_set1_ps(1.0f);
+    __m256 p[3];
+    for (int c = 0; c < 3; ++c) {
+        const auto i = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)in[c]));
+        p[c] = sop_ ? _mm256_i32gather_ps(&curve_[c * 65536], i, 4) : _mm256_mul_ps(_mm256_cvtepi32_ps(i), _mm256_set1_ps(1.0f / 65535.0f));
+    }
+    if (cdl_.saturation != 1.0f) {
+        const auto s = _mm256_set1_ps(cdl_.saturation);
+        const auto l = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p[0], _mm256_set1_ps(kLumaR)), _mm256_mul_ps(p[1], _mm256_set1_ps(kLumaG))), _mm256_mul_ps(p[2], _mm256_set1_ps(kLumaB)));
+        for (auto& x : p)
+            x = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(l, _mm256_mul_ps(s, _mm256_sub_ps(x, l))), zero), one);
+    }
+    if (lut_) {
+        const auto& lut = *lut_;
+        const int n = lut.size_;
+        __m256i i[3];
+        __m256 f[3];
+        for (int c = 0; c < 3; ++c) {
+            auto t = _mm256_mul_ps(_mm256_sub_ps(p[c], _mm256_set1_ps(lut.min_[c])), _mm256_set1_ps(lut.scale_[c]));
+            t = _mm256_min_ps(_mm256_max_ps(t, zero), _mm256_set1_ps(float(n - 1))); // nan is 0
+            i[c] = _mm256_min_epi32(_mm256_cvttps_epi32(t), _mm256_set1_epi32(n - 2));
+            f[c] = _mm256_sub_ps(t, _mm256_cvtepi32_ps(i[c]));
+        }
+        // offsets of the axes of the max and min fractions, ties have distinct axes
+        const auto dr = _mm256_set1_epi32(1);
+        const auto dg = _mm256_set1_epi32(n);
+        const auto db = _mm256_set1_epi32(n * n);
+        const auto d111 = _mm256_set1_epi32(1 + n + n * n);
+        const auto rg = _mm256_castps_si256(_mm256_cmp_ps(f[0], f[1], _CMP_GE_OQ));
+        const auto rb = _mm256_castps_si256(_mm256_cmp_ps(f[0], f[2], _CMP_GE_OQ));
+        const auto gb = _mm256_castps_si256(_mm256_cmp_ps(f[1], f[2], _CMP_GE_OQ));
+        const auto dmax = _mm256_blendv_epi8(_mm256_blendv_epi8(db, dg, gb), dr, _mm256_and_si256(rg, rb));
+        const auto rmin = _mm256_andnot_si256(_mm256_or_si256(rg, rb), _mm256_set1_epi32(-1));
+        const auto gmin = _mm256_andnot_si256(gb, rg);
+        const auto dmin = _mm256_blendv_epi8(_mm256_blendv_epi8(db, dg, gmin), dr, rmin);
+        const auto fmax = _mm256_max_ps(_mm256_max_ps(f[0], f[1]), f[2]);
+        const auto fmin = _mm256_min_ps(_mm256_min_ps(f[0], f[1]), f[2]);
+        const auto fmid = _mm256_sub_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(f[0], f[1]), f[2]), fmax), fmin);
+        const auto base = _mm256_add_epi32(_mm256_add_epi32(i[0], _mm256_mullo_epi32(i[1], dg)), _mm256_mullo_epi32(i[2], db));
+        const auto v1 = _mm256_add_epi32(base, dmax);
+        const __m256i vi[4] = {
+            _mm256_slli_epi32(base, 2),
+            _mm256_slli_epi32(v1, 2),
+            _mm256_slli_epi32(_mm256_add_epi32(v1, _mm256_sub_epi32(_mm256_sub_epi32(d111, dmax), dmin)), 2),
+            _mm256_slli_epi32(_mm256_add_epi32(base, d111), 2),
+        };
+        const __m256 w[4] = {_mm256_sub_ps(one, fmax), _mm256_sub_ps(fmax, fmid), _mm256_sub_ps(fmid, fmin), fmin};
+        for (int c = 0; c < 3; ++c) {
+            const auto data = lut.rgbx_.data() + c;
+            auto x = _mm256_mul_ps(_mm256_i32gather_ps(data, vi[0], 4), w[0]);
+            for (int k = 1; k < 4; ++k)
+                x = _mm256_add_ps(x, _mm256_mul_ps(_mm256_i32gather_ps(data, vi[k], 4), w[k]));
+            p[c] = x;
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        const auto x = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(p[c], zero), one), _mm256_set1_ps(65535.0f)), _mm256_set1_ps(0.5f)));
+        _mm_storeu_si128((__m128i*)out[c], _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1)));
+    }
+}
+#endif // R3D_AVX2
+
+template<class Io>
+void Grade::rows(Io io, int begin, int end) const
+{
+    for (int y = begin; y < end; ++y) {
+        io.row(y);
+        int x = 0;
+#if (R3D_AVX2 + 0)
+        if constexpr (Io::kInt) {
+            if (HasAVX2()) {
+                for (; x + 8 <= io.width; x += 8) {
+                    block8(io.planes(x), io.outPlanes(x));
+                    io.flush(x);
+                }
+            }
+        }
+#endif
+        for (; x < io.width; ++x) {
+            float rgb[3];
+            if constexpr (Io::kInt) {
+                uint16_t v[3];
+                io.get(x, v);
+                for (int c = 0; c < 3; ++c)
+                    rgb[c] = sop_ ? curve_[c * 65536 + v[c]] : float(v[c]) * (1.0f / 65535.0f);
+                finish(rgb, true);
+            } else {
+                io.get(x, rgb);
+                pixel(rgb, false);
+            }
+            io.set(x, rgb);
+        }
+    }
+}
+
+bool Grade::apply(FramePool::Buffer& buf, RowWorkers* workers) const
+{
+    return apply(buf, buf, workers);
+}
+
+bool Grade::apply(const FramePool::Buffer& src, FramePool::Buffer& dst, RowWorkers* workers) const
+{
+    const VideoFormat fmt(src.format);
+    const int w = src.width;
+    const int h = src.height;
+    if (!supports(src.format) || src.data.size() < fmt.bytesPerFrame(w, h))
+        return false;
+    if (dst.format != src.format || dst.width != w || dst.height != h || dst.data.size() < fmt.bytesPerFrame(w, h))
+        return false;
+    const auto data = src.data.constData();
+    const auto out = (uint8_t*)dst.data.data();
+    const size_t stride = fmt.bytesPerLine(w, 0);
+    auto run = [&](auto io) {
+        ParallelRows(h, workers, [&](int begin, int end) { rows(io, begin, end); });
+        return true;
+    };
+    switch (src.format) {
+    case PixelFormat::RGBP16: // planes of the same stride, see FramePool::frame()
+        return run(Planar16{{data, data + stride * h, data + stride * h * 2}, {out, out + stride * h, out + stride * h * 2}, stride, w});
+    case PixelFormat::RGB48:
+        return run(Packed16{{}, data, out, stride, w});
+    case PixelFormat::RGBF16:
+        return run(PackedHalf{data, out, stride, w});
+    default:
+        return run(Bgra8{{}, data, out, stride, w});
+    }
+}
+
+MDK_NS_END
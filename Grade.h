@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "FramePool.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+MDK_NS_BEGIN
+
+class RowWorkers;
+
+// ASC CDL: out = (in * slope + offset)^power, then saturation around Rec.709 luma. clamped to [0, 1]
+struct Cdl {
+    float slope[3] = {1.0f, 1.0f, 1.0f};
+    float offset[3] = {0.0f, 0.0f, 0.0f};
+    float power[3] = {1.0f, 1.0f, 1.0f};
+    float saturation = 1.0f;
+
+    bool identity() const;
+    // "sr sg sb or og ob pr pg pb sat", separated by spaces or commas. empty or "0": identity
+    bool parse(std::string_view s);
+};
+
+// 3D LUT from a .cube file, sampled by tetrahedral interpolation
+class Lut3D
+{
+public:
+    using Ptr = std::shared_ptr<const Lut3D>;
+    // nullptr if failed
+    static Ptr load(const std::string& path);
+
+    int size() const { return size_; }
+    // rgb in domain, clamped
+    void sample(const float* in, float* out) const;
+private:
+    friend class Grade;
+    int size_ = 0;
+    float min_[3] = {0.0f, 0.0f, 0.0f};
+    float scale_[3] = {1.0f, 1.0f, 1.0f}; // (size_ - 1) / (max - min)
+    std::vector<float> rgbx_; // size_^3 vertices of 4 floats, red changes fastest
+};
+
+// CDL then LUT applied to a decoded frame in place or to another buffer. immutable, replaced as a whole if a setting changes
+class Grade
+{
+public:
+    using Ptr = std::shared_ptr<const Grade>;
+    // nullptr if nothing to apply
+    static Ptr create(const Cdl& cdl, Lut3D::Ptr lut);
+
+    // RGBP16, RGB48, RGBF16, BGRA and BGRX
+    static bool supports(PixelFormat format);
+    // row bands are graded by workers, null: calling thread only
+    bool apply(FramePool::Buffer& buf, RowWorkers* workers = nullptr) const;
+    // src is not modified, dst is of the same size and format, e.g. src is kept for processing again
+    bool apply(const FramePool::Buffer& src, FramePool::Buffer& dst, RowWorkers* workers = nullptr) const;
+    // rgb in [0, 1] for 16/8bit, or any value for half float
+    void pixel(float* rgb, bool clamp) const;
+private:
+    Grade() = default;
+    template<class Io>
+    void rows(Io io, int begin, int end) const;
+    void finish(float* rgb, bool clamp) const; // saturation and LUT
+    void block8(const uint16_t* const* in, uint16_t* const* out) const; // 8 16bit pixels of r, g, b planes by AVX2. in may be out
+
+    Cdl cdl_;
+    bool sop_ = false; // slope, offset and power are not identity
+    std::vector<float> curve_; // 3x65536 SOP results of 16bit values
+    Lut3D::Ptr lut_;
+};
+
+MDK_NS_END
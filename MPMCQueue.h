@@ -1,58 +1,326 @@
 #pragma once
 
-#include <list>
-#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
+/*
+ * Bounded multi-producer multi-consumer ring (D. Vyukov's per-cell sequence algorithm).
+ * - fixed capacity(rounded up to a power of 2), no allocation after construction, items are moved in and out
+ * - try*() never block. push()/pop() spin for a while, then park on a condition variable.
+ *   the mutex is touched only when a thread is about to sleep or another thread is sleeping, never in the fast path
+ * - tryPushBatch()/popAll() claim a run of cells with a single CAS and wake the other side once
+ */
 template <typename T>
 class MPMCQueue
 {
 public:
-    template<typename U>
-    void push(U&& u) {
-        std::unique_lock lock(mtx_);
-        q_.push_back(std::forward<U>(u));
-        cv_.notify_one();
+    explicit MPMCQueue(size_t capacity = 64) {
+        size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        mask_ = n - 1;
+        cells_ = new Cell[n];
+        for (size_t i = 0; i < n; ++i)
+            cells_[i].seq.store(i, std::memory_order_relaxed);
     }
 
-    bool tryPop(T& t) {
-        std::unique_lock lock(mtx_);
-        if (q_.empty())
+    ~MPMCQueue() {
+        clear();
+        delete[] cells_;
+    }
+
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    // false if full, u is untouched then
+    template<typename U>
+    bool tryPush(U&& u) {
+        if (!put(std::forward<U>(u)))
             return false;
-        t = q_.front();
-        q_.pop_front();
+        wakeConsumers(1);
         return true;
     }
 
+    // wait for a free cell. false if woken up by notifyAll(), u is untouched then
+    template<typename U>
+    bool push(U&& u) {
+        return waitPush(std::forward<U>(u), nullptr);
+    }
 
-    bool pop(T& t) {
-        std::unique_lock lock(mtx_);
-        if (q_.empty())
-            cv_.wait(lock);
-        if (q_.empty())
+    // false if timed out or woken up by notifyAll(), u is untouched then
+    template<typename U, class Rep, class Period>
+    bool push(U&& u, const std::chrono::duration<Rep, Period>& timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        return waitPush(std::forward<U>(u), &deadline);
+    }
+
+    // move as many items from [first, first + n) as there are free cells. return the number of pushed items
+    template<typename It>
+    size_t tryPushBatch(It first, size_t n) {
+        if (n == 0)
+            return 0;
+        auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t k = 0;
+        for (;;) {
+            k = 0;
+            while (k < n && k <= mask_ && cells_[(pos + k) & mask_].seq.load(std::memory_order_acquire) == pos + k)
+                ++k;
+            if (k == 0) {
+                const auto dif = (intptr_t)cells_[pos & mask_].seq.load(std::memory_order_acquire) - (intptr_t)pos;
+                if (dif < 0) // full
+                    return 0;
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+                break;
+        }
+        for (size_t i = 0; i < k; ++i, ++first) {
+            auto& c = cells_[(pos + i) & mask_];
+            ::new (c.storage) T(std::move(*first));
+            c.seq.store(pos + i + 1, std::memory_order_release);
+        }
+        wakeConsumers(k);
+        return k;
+    }
+
+    bool tryPop(T& t) {
+        if (!take(t))
             return false;
-        t = q_.front();
-        q_.pop_front();
+        wakeProducers();
         return true;
     }
 
-    void notifyAll() {
-        cv_.notify_all();
+    // wait for an item. false if woken up by notifyAll()
+    bool pop(T& t) {
+        return waitPop(t, nullptr);
     }
 
-    auto clear() {
+    // false if timed out or woken up by notifyAll()
+    template<class Rep, class Period>
+    bool pop(T& t, const std::chrono::duration<Rep, Period>& timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        return waitPop(t, &deadline);
+    }
+
+    // move out all items currently in the queue and call f(T&&) for each in fifo order. return the number of items
+    template<typename F>
+    size_t popAll(F&& f) {
+        size_t total = 0;
+        for (;;) {
+            auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+            size_t k = 0;
+            for (;;) {
+                k = 0;
+                while (k <= mask_ && cells_[(pos + k) & mask_].seq.load(std::memory_order_acquire) == pos + k + 1)
+                    ++k;
+                if (k == 0) {
+                    const auto dif = (intptr_t)cells_[pos & mask_].seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+                    if (dif < 0) { // empty
+                        if (total > 0)
+                            wakeProducers();
+                        return total;
+                    }
+                    pos = dequeue_pos_.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed))
+                    break;
+            }
+            for (size_t i = 0; i < k; ++i) {
+                auto& c = cells_[(pos + i) & mask_];
+                T t(std::move(*c.item()));
+                c.item()->~T();
+                c.seq.store(pos + i + mask_ + 1, std::memory_order_release);
+                f(std::move(t));
+            }
+            total += k;
+        }
+    }
+
+    // wake up all threads blocked in push() and pop(), they return false
+    void notifyAll() {
+        epoch_.fetch_add(1, std::memory_order_acq_rel);
         std::lock_guard lock(mtx_);
-        auto n = q_.size();
-        q_.clear();
+        pop_cv_.notify_all();
+        push_cv_.notify_all();
+    }
+
+    size_t clear() {
+        size_t n = 0;
+        T t;
+        while (take(t))
+            ++n;
+        if (n > 0)
+            wakeProducers();
         return n;
     }
 
-    auto size() const {
-        std::lock_guard lock(mtx_);
-        return q_.size();
+    size_t size() const {
+        const auto d = dequeue_pos_.load(std::memory_order_acquire);
+        const auto e = enqueue_pos_.load(std::memory_order_acquire);
+        return e > d ? e - d : 0;
     }
+
+    bool empty() const { return size() == 0; }
+
+    size_t capacity() const { return mask_ + 1; }
 private:
-    std::list<T> q_;
-    mutable std::mutex mtx_;
-    std::condition_variable cv_;
-};
\ No newline at end of file
+    static constexpr int kSpinCount = 64;
+
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    template<typename U>
+    bool put(U&& u) {
+        Cell* c = nullptr;
+        auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells_[pos & mask_];
+            const auto dif = (intptr_t)c->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) { // full
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        ::new (c->storage) T(std::forward<U>(u));
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool take(T& t) {
+        Cell* c = nullptr;
+        auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells_[pos & mask_];
+            const auto dif = (intptr_t)c->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (dif < 0) { // empty
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        t = std::move(*c->item());
+        c->item()->~T();
+        c->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    template<typename U>
+    bool waitPush(U&& u, const std::chrono::steady_clock::time_point* deadline) {
+        if (tryPush(std::forward<U>(u)))
+            return true;
+        const auto epoch = epoch_.load(std::memory_order_acquire);
+        for (int i = 0; i < kSpinCount; ++i) {
+            relax(i);
+            if (tryPush(std::forward<U>(u)))
+                return true;
+        }
+        std::unique_lock lock(mtx_);
+        push_waiters_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ok = false;
+        while (!(ok = put(std::forward<U>(u))) && epoch_.load(std::memory_order_acquire) == epoch) {
+            if (!deadline) {
+                push_cv_.wait(lock);
+            } else if (push_cv_.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                ok = put(std::forward<U>(u));
+                break;
+            }
+        }
+        push_waiters_.fetch_sub(1);
+        lock.unlock();
+        if (ok)
+            wakeConsumers(1);
+        return ok;
+    }
+
+    bool waitPop(T& t, const std::chrono::steady_clock::time_point* deadline) {
+        const auto epoch = epoch_.load(std::memory_order_acquire);
+        for (int i = 0; i < kSpinCount; ++i) {
+            if (tryPop(t))
+                return true;
+            relax(i);
+        }
+        std::unique_lock lock(mtx_);
+        pop_waiters_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with the fence in wakeConsumers()
+        bool ok = false;
+        while (!(ok = take(t)) && epoch_.load(std::memory_order_acquire) == epoch) {
+            if (!deadline) {
+                pop_cv_.wait(lock);
+            } else if (pop_cv_.wait_until(lock, *deadline) == std::cv_status::timeout) {
+                ok = take(t);
+                break;
+            }
+        }
+        pop_waiters_.fetch_sub(1);
+        lock.unlock();
+        if (ok)
+            wakeProducers();
+        return ok;
+    }
+
+    void wakeConsumers(size_t n) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (pop_waiters_.load(std::memory_order_relaxed) == 0)
+            return;
+        std::lock_guard lock(mtx_);
+        if (n == 1)
+            pop_cv_.notify_one();
+        else
+            pop_cv_.notify_all();
+    }
+
+    void wakeProducers() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (push_waiters_.load(std::memory_order_relaxed) == 0)
+            return;
+        std::lock_guard lock(mtx_);
+        push_cv_.notify_all();
+    }
+
+    static void relax(int i) {
+        if (i < kSpinCount / 2) {
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+            _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+            __asm__ __volatile__("yield");
+#endif
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    Cell* cells_ = nullptr;
+    size_t mask_ = 0;
+    alignas(64) std::atomic<size_t> enqueue_pos_ = 0;
+    alignas(64) std::atomic<size_t> dequeue_pos_ = 0;
+    alignas(64) std::atomic<uint32_t> epoch_ = 0;
+    std::atomic<int> pop_waiters_ = 0;
+    std::atomic<int> push_waiters_ = 0;
+    std::mutex mtx_;
+    std::condition_variable pop_cv_;
+    std::condition_variable push_cv_;
+};
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "MediaInfoCache.h"
+#include "base/Hash.h"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+constexpr uint32_t kVersion = 1;
+static const char kMagic[8] = {'R', '3', 'D', 'I', 'N', 'F', 'O', '\0'};
+
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+static bool Stat(const string& path, FileStamp& st)
+{
+    error_code ec;
+    st.size = filesystem::file_size(path, ec);
+    if (ec)
+        return false;
+    st.mtime = filesystem::last_write_time(path, ec).time_since_epoch().count();
+    return !ec;
+}
+
+// little endian host order. an entry is never shared between machines
+class Writer
+{
+public:
+    template<typename T>
+    void put(const T& v) { static_assert(is_trivially_copyable_v<T>); data_.append((const char*)&v, sizeof(v)); }
+    void put(string_view s) {
+        put((uint32_t)s.size());
+        data_.append(s.data(), s.size());
+    }
+    void put(const unordered_map<string, string>& m) {
+        put((uint32_t)m.size());
+        for (const auto& [k, v] : m) {
+            put(string_view(k));
+            put(string_view(v));
+        }
+    }
+    const string& data() const { return data_; }
+private:
+    string data_;
+};
+
+class Reader
+{
+public:
+    Reader(string_view data) : data_(data) {}
+    bool ok() const { return ok_; }
+
+    template<typename T>
+    void get(T& v) {
+        static_assert(is_trivially_copyable_v<T>);
+        if (!ok_ || data_.size() < sizeof(v)) {
+            ok_ = false;
+            return;
+        }
+        memcpy(&v, data_.data(), sizeof(v));
+        data_.remove_prefix(sizeof(v));
+    }
+    void get(string& s) {
+        uint32_t n = 0;
+        get(n);
+        if (!ok_ || data_.size() < n) {
+            ok_ = false;
+            return;
+        }
+        s.assign(data_.data(), n);
+        data_.remove_prefix(n);
+    }
+    void get(unordered_map<string, string>& m) {
+        uint32_t n = 0;
+        get(n);
+        for (uint32_t i = 0; i < n && ok_; ++i) {
+            string k, v;
+            get(k);
+            get(v);
+            m.emplace(std::move(k), std::move(v));
+        }
+    }
+private:
+    string_view data_;
+    bool ok_ = true;
+};
+
+// fields set by to(MediaInfo&, const R3DSDK::Clip*)
+template<class IO, class Info>
+static bool Serialize(IO& io, Info& info)
+{
+    const auto io_all = [&io](auto&... v) { (io(v), ...); };
+    io_all(info.start_time, info.duration, info.bit_rate, info.size, info.format, info.streams, info.metadata);
+    uint32_t videos = (uint32_t)info.video.size();
+    uint32_t audios = (uint32_t)info.audio.size();
+    io_all(videos, audios);
+    if constexpr (!is_const_v<Info>) {
+        if (videos > 16 || audios > 16) // corrupted
+            return false;
+        info.video.resize(videos);
+        info.audio.resize(audios);
+    }
+    for (auto& v : info.video) {
+        auto& c = v.codec;
+        io_all(v.index, v.start_time, v.duration, v.frames, v.rotation, v.metadata);
+        io_all(c.codec, c.codec_tag, c.bit_rate, c.profile, c.level, c.frame_rate, c.format, c.width, c.height, c.b_frames, c.par);
+    }
+    for (auto& a : info.audio) {
+        auto& c = a.codec;
+        io_all(a.index, a.start_time, a.duration, a.frames, a.metadata);
+        io_all(c.codec, c.codec_tag, c.bit_rate, c.profile, c.level, c.frame_rate, c.is_float, c.is_unsigned, c.is_planar, c.raw_sample_size
+            , c.channels, c.sample_rate, c.block_align, c.frame_size, c.channel_layout, c.bits_per_raw_sample, c.bits_per_coded_sample, c.format);
+    }
+    return true;
+}
+
+string MediaInfoCache::entry(const string& path) const
+{
+    char name[24]{};
+    snprintf(name, sizeof(name), "%016llx.info", (unsigned long long)detail::fnv1ah64::hash(path.data(), path.size()));
+    return (filesystem::path(dir_) / name).string();
+}
+
+bool MediaInfoCache::load(const string& path, MediaInfo& info) const
+{
+    FileStamp st;
+    if (dir_.empty() || !Stat(path, st))
+        return false;
+    auto f = fopen(entry(path).data(), "rb");
+    if (!f)
+        return false;
+    string data;
+    char buf[4096];
+    while (const auto n = fread(buf, 1, sizeof(buf), f))
+        data.append(buf, n);
+    fclose(f);
+
+    Reader r(data);
+    char magic[sizeof(kMagic)]{};
+    uint32_t version = 0;
+    string file;
+    FileStamp cached;
+    r.get(magic);
+    r.get(version);
+    r.get(file);
+    r.get(cached.size);
+    r.get(cached.mtime);
+    if (!r.ok() || memcmp(magic, kMagic, sizeof(kMagic)) != 0 || version != kVersion
+        || file != path || cached.size != st.size || cached.mtime != st.mtime)
+        return false;
+    MediaInfo tmp;
+    auto io = [&r](auto& v) { r.get(v); };
+    if (!Serialize(io, tmp) || !r.ok())
+        return false;
+    info = std::move(tmp);
+    return true;
+}
+
+bool MediaInfoCache::save(const string& path, const MediaInfo& info) const
+{
+    FileStamp st;
+    if (dir_.empty() || !Stat(path, st))
+        return false;
+    Writer w;
+    w.put(kMagic);
+    w.put(kVersion);
+    w.put(string_view(path));
+    w.put(st.size);
+    w.put(st.mtime);
+    auto io = [&w](const auto& v) {
+        if constexpr (is_same_v<decay_t<decltype(v)>, string>)
+            w.put(string_view(v));
+        else
+            w.put(v);
+    };
+    Serialize(io, info);
+
+    error_code ec;
+    filesystem::create_directories(dir_, ec);
+    const auto file = entry(path);
+    const auto tmp = file + ".tmp"; // readers never see a partial entry
+    auto f = fopen(tmp.data(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(w.data().data(), 1, w.data().size(), f) == w.data().size();
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+        ok = rename(tmp.data(), file.data()) == 0;
+    if (!ok)
+        remove(tmp.data());
+    return ok;
+}
+
+MDK_NS_END
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/MediaInfo.h"
+#include <string>
+
+MDK_NS_BEGIN
+
+// On-disk cache of MediaInfo built from clip metadata, one file per clip in dir.
+// An entry is used only if path, file size and modification time are the same as when it was saved
+class MediaInfoCache
+{
+public:
+    // empty: disabled. created on save
+    void setDir(const std::string& dir) { dir_ = dir; }
+    const std::string& dir() const { return dir_; }
+
+    bool load(const std::string& path, MediaInfo& info) const;
+    bool save(const std::string& path, const MediaInfo& info) const;
+private:
+    std::string entry(const std::string& path) const;
+
+    std::string dir_;
+};
+
+MDK_NS_END
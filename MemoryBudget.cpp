@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "MemoryBudget.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <variant>
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <unistd.h>
+#endif
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+constexpr size_t kMB = 1 << 20;
+constexpr auto kPsiInterval = chrono::seconds(1);
+
+int GlobalOption(const char* name, int defaultValue)
+{
+    decltype(auto) v = GetGlobalOption(name);
+    if (const auto i = get_if<int>(&v))
+        return *i;
+    if (const auto s = get_if<string>(&v); s && !s->empty())
+        return atoi(s->data());
+    return defaultValue;
+}
+
+static size_t PhysicalMemory()
+{
+#if defined(_WIN32)
+    MEMORYSTATUSEX ms{};
+    ms.dwLength = sizeof(ms);
+    if (GlobalMemoryStatusEx(&ms))
+        return (size_t)ms.ullTotalPhys;
+    return 0;
+#elif defined(_SC_PHYS_PAGES)
+    const auto pages = sysconf(_SC_PHYS_PAGES);
+    const auto page = sysconf(_SC_PAGE_SIZE);
+    return pages > 0 && page > 0 ? (size_t)pages * (size_t)page : 0;
+#else
+    return 0;
+#endif
+}
+
+MemoryBudget& MemoryBudget::instance()
+{
+    static MemoryBudget b;
+    return b;
+}
+
+MemoryBudget::MemoryBudget()
+{
+    const auto phys = PhysicalMemory();
+    const auto def = phys > 0 ? std::max<size_t>(phys / 4 / kMB, 1024) : 4096;
+    capacity_ = (size_t)std::max(GlobalOption("R3D_MEMORY_BUDGET", (int)std::min<size_t>(def, INT32_MAX)), 256) * kMB;
+    psi_ = GlobalOption("R3D_MEMORY_PSI", psi_);
+    clog << "R3D memory budget " << capacity_ / kMB << "MB" << endl;
+}
+
+size_t MemoryBudget::used() const
+{
+    const lock_guard lock(mtx_);
+    return used_;
+}
+
+bool MemoryBudget::tryCharge(size_t bytes)
+{
+    const lock_guard lock(mtx_);
+    if (used_ + bytes > capacity_)
+        return false;
+    used_ += bytes;
+    return true;
+}
+
+void MemoryBudget::charge(size_t bytes)
+{
+    const lock_guard lock(mtx_);
+    used_ += bytes;
+}
+
+void MemoryBudget::release(size_t bytes)
+{
+    const lock_guard lock(mtx_);
+    used_ -= std::min(used_, bytes);
+}
+
+size_t MemoryBudget::depth(size_t bytes, size_t minCount, size_t maxCount)
+{
+    const auto tight = pressure();
+    const lock_guard lock(mtx_);
+    const auto avail = capacity_ > used_ ? capacity_ - used_ : 0;
+    auto n = avail / std::max<size_t>(bytes, 1);
+    if (tight)
+        n /= 2;
+    return std::clamp(n, minCount, std::max(minCount, maxCount));
+}
+
+bool MemoryBudget::pressure()
+{
+    const auto now = chrono::steady_clock::now();
+    {
+        const lock_guard lock(mtx_);
+        if (used_ > capacity_ / 8 * 7)
+            return true;
+        if (now - sampled_ < kPsiInterval)
+            return pressure_;
+        sampled_ = now;
+    }
+    const auto p = readPressure(); // no lock for file io, a concurrent sample gets the last value
+    const lock_guard lock(mtx_);
+    if (p != pressure_)
+        clog << "R3D memory pressure: " << p << endl;
+    pressure_ = p;
+    return p;
+}
+
+bool MemoryBudget::readPressure() const
+{
+#if (__linux__ + 0)
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    auto f = fopen("/proc/pressure/memory", "r");
+    if (!f)
+        return false;
+    float avg10 = 0;
+    const auto n = fscanf(f, "some avg10=%f", &avg10);
+    fclose(f);
+    return n == 1 && avg10 > psi_;
+#else
+    return false;
+#endif
+}
+
+void MemoryBudget::Lease::reset(size_t bytes)
+{
+    auto& b = MemoryBudget::instance();
+    if (bytes_ > 0)
+        b.release(bytes_);
+    bytes_ = bytes;
+    if (bytes_ > 0)
+        b.charge(bytes_);
+}
+
+MDK_NS_END
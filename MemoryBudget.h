@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/global.h"
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+MDK_NS_BEGIN
+
+// global option as an int, a string value is parsed
+int GlobalOption(const char* name, int defaultValue);
+
+// Process-wide budget of host memory for decoded frames, decompress buffers and audio blocks of all readers.
+// Capacity is global option "R3D_MEMORY_BUDGET" in MB, default is 1/4 of physical memory.
+// Memory is under pressure if the budget is almost used up, or on linux if PSI memory "some avg10" exceeds global option "R3D_MEMORY_PSI"(%, default 10).
+class MemoryBudget
+{
+public:
+    static MemoryBudget& instance();
+
+    size_t capacity() const { return capacity_; }
+    size_t used() const;
+    // charge if it fits
+    bool tryCharge(size_t bytes);
+    // required memory, may exceed capacity
+    void charge(size_t bytes);
+    void release(size_t bytes);
+    // buffers of bytes a reader should allocate, in [minCount, maxCount]
+    size_t depth(size_t bytes, size_t minCount, size_t maxCount);
+    // readers should shrink pools and caches
+    bool pressure();
+
+    // memory charged for the lifetime of an object
+    class Lease
+    {
+    public:
+        Lease() = default;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease() { reset(); }
+        void reset(size_t bytes = 0);
+        size_t bytes() const { return bytes_; }
+    private:
+        size_t bytes_ = 0;
+    };
+private:
+    MemoryBudget();
+    bool readPressure() const;
+
+    size_t capacity_ = 0;
+    size_t used_ = 0;
+    int psi_ = 10;
+    bool pressure_ = false;
+    std::chrono::steady_clock::time_point sampled_; // psi
+    mutable std::mutex mtx_;
+};
+
+MDK_NS_END
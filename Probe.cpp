@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "Probe.h"
+#include "MediaInfoCache.h"
+#include "R3DCxxAbi.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <thread>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+bool ProbeOptions::keep(const string& key) const
+{
+    if (!metadata)
+        return false;
+    if (keys.empty())
+        return true;
+    return any_of(keys.cbegin(), keys.cend(), [&key](const string& k) { return key.starts_with(k); });
+}
+
+void ProbeOptions::setMetadata(const string& value)
+{
+    keys.clear();
+    metadata = value != "none" && value != "0";
+    if (!metadata || value == "all" || value == "1" || value.empty())
+        return;
+    for (size_t i = 0; i < value.size();) {
+        auto end = value.find(',', i);
+        if (end == string::npos)
+            end = value.size();
+        if (end > i)
+            keys.push_back(value.substr(i, end - i));
+        i = end + 1;
+    }
+}
+
+void to(MediaInfo& info, const R3DSDK::Clip* clip, const ProbeOptions& opts)
+{
+    info.format = "r3d";
+
+    info.streams = clip->VideoTrackCount();
+    if (info.streams <= 0)
+        return;
+
+    const auto m = opts.metadata ? clip->MetadataCount() : 0;
+    for (size_t i = 0; i < m; ++i) {
+        // compare in sdk, only kept items are copied out
+        if (!opts.keys.empty() && none_of(opts.keys.cbegin(), opts.keys.cend(), [&](const string& k) { return MetadataItemKeyStartsWith(clip, i, k.data()); }))
+            continue;
+        auto key = MetadataItemKey(clip, i);
+        auto val = MetadataItemAsString(clip, i);
+        info.metadata.emplace(key, val);
+        free(key);
+        free(val);
+    }
+
+    VideoCodecParameters vcp;
+    vcp.codec = "r3d";
+    vcp.width = clip->Width();
+    vcp.height = clip->Height();
+    vcp.frame_rate = clip->VideoAudioFramerate();
+    VideoStreamInfo vsi;
+    vsi.index = 0;
+    vsi.frames = clip->VideoFrameCount();
+    vsi.duration = vsi.frames * (1000.0 / vcp.frame_rate);
+    vsi.codec = vcp;
+    info.video.reserve(clip->VideoTrackCount());
+    info.video.push_back(vsi);
+    info.duration = vsi.duration;
+
+    if (clip->AudioChannelCount() == 0)
+        return;
+    info.streams++;
+    AudioCodecParameters acp;
+    AudioStreamInfo asi;
+    asi.index = 1;
+    acp.codec = "pcm_s32be";
+    acp.block_align = 8; // why 8?
+    acp.bits_per_raw_sample = 24;
+    acp.bits_per_coded_sample = 32;
+    acp.format = AudioFormat::SampleFormat::S32; // clip->MetadataItemAsInt(RMD_SAMPLE_SIZE) is always 24
+    acp.channels = clip->AudioChannelCount();
+    acp.channel_layout = (uint64_t)clip->MetadataItemAsInt(R3DSDK::RMD_CHANNEL_MASK);
+    acp.sample_rate = clip->MetadataItemAsInt(R3DSDK::RMD_SAMPLERATE); // always 48000
+
+    asi.frames = clip->AudioSampleCount();
+    asi.duration = asi.frames * 1000 / acp.sample_rate;
+    asi.codec = acp;
+    info.audio.reserve(1);
+    info.audio.push_back(asi);
+
+    info.duration = std::max<int64_t>(info.duration, asi.duration);
+}
+
+bool ProbeClip(const string& path, MediaInfo& info, const ProbeOptions& opts)
+{
+    if (InitSdk() != R3DSDK::ISInitializeOK)
+        return false;
+    return ProbeClip(nullptr, path, info, opts);
+}
+
+bool ProbeClip(const R3DSDK::Clip* clip, const string& path, MediaInfo& info, const ProbeOptions& opts)
+{
+    const auto filter = [&opts](MediaInfo& i) {
+        erase_if(i.metadata, [&opts](const auto& kv) { return !opts.keep(kv.first); });
+    };
+    const auto cache = opts.cache && !opts.cache->dir().empty() ? opts.cache : nullptr;
+    if (cache && cache->load(path, info)) {
+        filter(info);
+        return true;
+    }
+    unique_ptr<R3DSDK::Clip> opened;
+    if (!clip) {
+        opened = make_unique<R3DSDK::Clip>(path.data());
+        clip = opened.get();
+    }
+    if (clip->Status() != R3DSDK::LoadStatus::LSClipLoaded) {
+        clog << "R3D probe " << path << " error: " << clip->Status() << endl;
+        return false;
+    }
+    info = {};
+    if (!cache) {
+        to(info, clip, opts);
+        return true;
+    }
+    // walk all items once, later opens are filtered from cache
+    ProbeOptions all;
+    to(info, clip, all);
+    cache->save(path, info);
+    filter(info);
+    return true;
+}
+
+vector<ProbeResult> ProbeClips(const vector<string>& paths, const ProbeOptions& opts, int threads)
+{
+    vector<ProbeResult> results(paths.size());
+    if (threads <= 0)
+        threads = (int)std::max(thread::hardware_concurrency(), 1u);
+    threads = (int)std::min<size_t>(threads, paths.size());
+    atomic<size_t> next = 0;
+    const auto probe = [&] {
+        for (size_t i = next++; i < paths.size(); i = next++)
+            results[i].ok = ProbeClip(paths[i], results[i].info, opts);
+    };
+    vector<thread> workers;
+    workers.reserve(threads);
+    for (int i = 1; i < threads; ++i)
+        workers.emplace_back(probe);
+    if (threads > 0)
+        probe(); // current thread is also a worker
+    for (auto& t : workers)
+        t.join();
+    return results;
+}
+
+MDK_NS_END
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/MediaInfo.h"
+#include "R3DSDK.h"
+#include <string>
+#include <vector>
+
+MDK_NS_BEGIN
+
+class MediaInfoCache;
+
+// InitializeSdk() only once in a background thread. R3DSDK_DIR must be set before
+void StartInitSdk();
+// wait for initialization
+R3DSDK::InitializeStatus InitSdk();
+// OPTION_RED_* runtime libraries loaded, 0 if initialization failed
+int SdkFlags();
+
+struct ProbeOptions {
+    bool metadata = true; // clip metadata items in MediaInfo.metadata
+    std::vector<std::string> keys; // metadata key prefixes to keep, empty: all
+    const MediaInfoCache* cache = nullptr; // entries always have all metadata, filtered after load
+
+    bool keep(const std::string& key) const;
+    // "all"/"1", "none"/"0", or comma separated key prefixes
+    void setMetadata(const std::string& value);
+};
+
+void to(MediaInfo& info, const R3DSDK::Clip* clip, const ProbeOptions& opts = {});
+
+// MediaInfo of a clip without decoder, frame buffers or threads
+bool ProbeClip(const std::string& path, MediaInfo& info, const ProbeOptions& opts = {});
+// clip of path is already opened, used if not in cache
+bool ProbeClip(const R3DSDK::Clip* clip, const std::string& path, MediaInfo& info, const ProbeOptions& opts = {});
+
+struct ProbeResult {
+    bool ok = false;
+    MediaInfo info;
+};
+// probe in parallel on at most threads threads, 0: hardware concurrency. results[i] is of paths[i]
+std::vector<ProbeResult> ProbeClips(const std::vector<std::string>& paths, const ProbeOptions& opts = {}, int threads = 0);
+
+MDK_NS_END
@@ -30,6 +30,12 @@ char* MetadataItemAsString(const R3DSDK::Clip* clip, size_t index)
             (clip->MetadataItemAsString(index).data());
 }
 
+bool MetadataItemKeyStartsWith(const R3DSDK::Clip* clip, size_t index, const char* prefix)
+{
+    const auto key = clip->MetadataItemKey(index);
+    return key.compare(0, strlen(prefix), prefix) == 0;
+}
+
 R3DSDK::R3DStatus SetupCudaCLDevices(R3DSDK::R3DDecoderOptions* opts, int type)
 {
     auto status = R3DSDK::R3DStatus_NoGPUDeviceSpecified;
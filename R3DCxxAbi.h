@@ -10,5 +10,7 @@
 // MUST free() the returned string
 char* MetadataItemKey(const R3DSDK::Clip* clip, size_t index);
 char* MetadataItemAsString(const R3DSDK::Clip* clip, size_t index);
+// no copy, for filtering items before MetadataItemKey()/MetadataItemAsString()
+bool MetadataItemKeyStartsWith(const R3DSDK::Clip* clip, size_t index, const char* prefix);
 
 R3DSDK::R3DStatus SetupCudaCLDevices(R3DSDK::R3DDecoderOptions* opts, int type/*1: cuda, 2: opencl*/);
\ No newline at end of file
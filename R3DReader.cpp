@@ -6,39 +6,50 @@
 #include "mdk/MediaInfo.h"
 #include "mdk/VideoFrame.h"
 #include "mdk/AudioFrame.h"
-#include "mdk/AudioDecoder.h"
-#include "mdk/Packet.h"
 //#include "base/ByteArray.h"
-#include "base/ByteArrayBuffer.h"
 #include "base/fmt.h"
 #include "base/Hash.h"
+#include "AudioBuffer.h"
 #include "MPMCQueue.h"
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <condition_variable>
+#include <future>
+#include <filesystem>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <string_view>
 #include <thread>
 #include "R3DSDK.h"
 #include "R3DSDKDecoder.h"
 #include "R3DCxxAbi.h"
+#include "Convert.h"
 #include "Debayer.h"
+#include "DecoderService.h"
+#include "FrameCache.h"
+#include "FramePool.h"
+#include "Grade.h"
+#include "MediaInfoCache.h"
+#include "MemoryBudget.h"
+#include "Probe.h"
+#include "ReorderBuffer.h"
+#include "Waveform.h"
 #if (__APPLE__ + 0) || (__linux__ + 0)
 #include <sys/resource.h>
 #endif
 
-// TODO: 1 job + frame pool(mutex based)
-// TODO: safe queue
-
 using namespace std;
 
 MDK_NS_BEGIN
 
 constexpr uint16_t kAudioAlign = 512;
+constexpr auto kFrameBufferTimeout = chrono::milliseconds(2000); // wait for renderer to release a frame
+constexpr size_t kMaxWindow = 48; // decoded-ahead frames, less than outputs_ capacity
 
 class R3DReader final : public FrameReader
 {
@@ -52,17 +63,26 @@ public:
 
     R3DReader();
     ~R3DReader() override {
+        stopCpuDecoders();
+        stopPreview();
+        stopWaveform();
+        if (probe_thread_.joinable())
+            probe_thread_.join();
         if (output_thread_.joinable())
             output_thread_.join();
+        if (fill_thread_.joinable())
+            fill_thread_.join();
         if (audio_thread_.joinable())
             audio_thread_.join();
+        if (audio_output_thread_.joinable())
+            audio_output_thread_.join();
         if (init_) {
             //R3DSDK::FinalizeSdk(); // FIXME: crash
         }
     }
 
     const char* name() const override { return "R3D"; }
-    void setTimeout(int64_t value, TimeoutCallback cb) override {}
+    void setTimeout(int64_t value, TimeoutCallback cb) override;
     bool load() override;
     bool unload() override;
     bool seekTo(int64_t msec, SeekFlag flag, int id) override;
@@ -74,163 +94,327 @@ private:
     bool readAt(uint64_t index, int seekId = -1, SeekFlag flag = SeekFlag::Default);
     void readAudioAt(size_t index, int seekId = -1);
 
+    bool openClip(); // cancellable by unload()
     void setupAudio(const AudioCodecParameters& par);
     void parseDecoderOptions();
+    void setupOutput();
     bool setupDecoder();
     void setupDecodeJobs();
 
-    R3DSDK::R3DDecodeJob* getJob(size_t index);
+    struct UserData;
+    R3DSDK::R3DDecodeJob* getJob(const UserData& task, bool wait);
     void onJobComplete(R3DSDK::R3DDecodeJob *job, R3DSDK::R3DStatus status);
 
-    R3DSDK::AsyncDecompressJob* getDecompressJob(size_t index);
+    R3DSDK::AsyncDecompressJob* getDecompressJob(const UserData& task);
+    void releaseDecompressJob(size_t i);
     void onJobComplete(R3DSDK::AsyncDecompressJob *job, R3DSDK::DecodeStatus status);
 
-    void audioLoop();
+    struct AudioBlock {
+        size_t index = 0;
+        uint32_t gen = 0; // audio_gen_ when read
+        int seekId = -1;
+        shared_ptr<AudioBuffer> buffer; // null if decode error
+    };
+    void audioLoop(); // read ahead
+    void audioOutputLoop();
     void outputLoop();
+    void cpuDecodeLoop();
+    void startCpuDecoders();
+    void stopCpuDecoders();
+    void previewLoop();
+    void setupPreview();
+    void stopPreview();
+    void startWaveform();
+    void stopWaveform();
+    void buildWaveform(const string& url, const string& path);
+    void publishWaveform(const Waveform& wf);
+    void queryMetadata(const string& prefix);
+    void probeClips(const string& paths);
+
+    // image processing settings of decodes. "ip.*" properties publish a new snapshot, a job keeps the one it is submitted with
+    struct ImageProcessing {
+        R3DSDK::ImageProcessingSettings settings;
+        uint64_t hash = 0; // settings hash in cache keys
+    };
+    using ImageProcessingPtr = shared_ptr<const ImageProcessing>;
 
     struct UserData {
         R3DReader* reader = nullptr;
         uint64_t index = 0;
+        uint32_t gen = 0; // generation, increased by seek
         int seekId = 0;
         bool seekWaitFrame = true;
-        VideoFrame frame; // TODO: BufferRef with deleter to recyle Buffer*. BufferPool clear buffers if size or format changed
+        shared_ptr<atomic<bool>> seekCompleted; // shared by the preview and decoded tasks of a seek, seekComplete() is called once
+        FramePool::BufferRef buffer; // decoder output, back to pool_ when the last frame using it is released
         size_t decompressIndex = 0;
         void* debayerJob = nullptr;
-        R3DSDK::VideoDecodeJob* swJob = nullptr;
+        bool ready = false; // counted in ready_
+        VideoFrame frame; // from cache_ or preview, not decoded
+        bool preview = false; // low resolution frame of a seek target, shown before the decoded one
+        bool skip = false; // not decoded because it can not be delivered in time
+        bool refresh = false; // not decoded, processed again from kept_ with current settings
+        ImageProcessingPtr ips; // of the decode or debayer job, alive until the job is released
+        R3DSDK::VideoDecodeMode mode = R3DSDK::DECODE_FULL_RES_PREMIUM;
+        chrono::steady_clock::time_point start; // decode
     };
 
-    R3DSDK::VideoDecodeJob* getVideoDecodeJob(size_t index, UserData* data) {
-        frame_idx_ = (frame_idx_+1) % (int)sw_job_.size();
-        data->index = index;
-        data->frame = frame_[frame_idx_];
-        return &sw_job_[frame_idx_];
-    }
-
-    void process(const UserData& data);
-
-    void push(const UserData& data) {
-        const unique_lock lock(output_mtx_);
-        outputs_.push(data);
-        output_cv_.notify_one();
-    }
+    // hash: image processing and grade settings of the frame
+    FrameCache::Key cacheKey(uint64_t index, R3DSDK::VideoDecodeMode mode, uint64_t hash) const {
+        return {index, (int)mode, format_, hash};
+    }
+    FrameCache::Key cacheKey(uint64_t index, R3DSDK::VideoDecodeMode mode) const {
+        uint64_t hash = 0;
+        grade(&hash);
+        if (const auto ips = imageProcessing())
+            hash ^= ips->hash;
+        return cacheKey(index, mode, hash);
+    }
+    FrameCache::Key cacheKey(uint64_t index) const { return cacheKey(index, decodeMode()); }
+
+    // current mode of new decodes
+    R3DSDK::VideoDecodeMode decodeMode() const { return modes_.empty() ? mode_ : modes_[level_]; }
+    // mode of a decoded frame in buf
+    R3DSDK::VideoDecodeMode decodeMode(const FramePool::Buffer& buf) const;
+    void adapt(R3DSDK::VideoDecodeMode mode, chrono::steady_clock::time_point start);
+    // current grade and its settings hash, replaced by "lut" and "cdl" properties from any thread
+    Grade::Ptr grade(uint64_t* hash = nullptr) const;
+    void updateGrade();
+    // current image processing settings for new jobs. null before load()
+    ImageProcessingPtr imageProcessing() const;
+    // kept_ can be processed again for index with current settings
+    bool refreshable(uint64_t index) const;
+    // data.buffer or data.debayerJob from kept_. output thread only
+    void restore(UserData& data);
+    // deliver kept_ again after a setting change if still on screen, or decode its index again if kept_ can not be processed with new settings.
+    // frames decoded ahead with old settings are discarded
+    void refresh();
+    // decoded buf to a convert_pool_ frame of format_. output thread only
+    VideoFrame convert(const FramePool::BufferRef& buf);
+    uint64_t deliverable() const; // 1st index can be decoded before presentation. sched_mtx_ must be locked
+    void updateClock(const UserData& data, chrono::steady_clock::time_point begin, chrono::steady_clock::time_point end);
+
+    // a new generation starts from index. sched_mtx_ must be locked
+    void restart(uint64_t index) {
+        ++gen_;
+        base_ = index;
+        head_ = index;
+        next_submit_ = index;
+        seek_ = {};
+        priming_ = true;
+        clock_valid_ = false;
+    }
+
+    bool isCurrent(uint32_t gen, uint64_t* base = nullptr) const {
+        const lock_guard lock(sched_mtx_);
+        if (base)
+            *base = base_;
+        return gen == gen_;
+    }
+
+    size_t depth() const; // frames decoding in parallel
+    size_t ahead() const { return std::max(depth(), window_); }
+    bool schedule(uint64_t index, int seekId, SeekFlag flag);
+    bool fill(bool wait);
+    void requestFill(); // fill(false) on fill_thread_
+    void fillLoop();
+    bool fillOnce(bool wait);
+    bool submit(UserData&& task, bool wait); // to R3DDecoder or decompressor
+    void process(UserData& data);
+    bool completeSeek(UserData& data);
+    void drop(UserData& data);
+    void push(UserData&& data);
+    void cancel(); // decodes of old generations
 
     bool pop(UserData& data) {
-        unique_lock lock(output_mtx_);
         if (!output_running_) // unload
             return false;
-        if (outputs_.empty())
-            output_cv_.wait(lock);
-        if (outputs_.empty())
-            return false;
-        data = outputs_.front();
-        outputs_.pop();
-        return true;
+        return outputs_.pop(data, chrono::milliseconds(100)); // timed: a notifyAll() from unload() may come before waiting
     }
 
     bool init_ = false;
+    // clip is opened in a worker thread, load() waits for it until timeout or unload()
+    mutex open_mtx_;
+    int64_t timeout_ = 0; // ms, <= 0: infinite
+    TimeoutCallback timeout_cb_;
+    shared_ptr<atomic<bool>> open_cancel_;
+    // MediaInfo is published before decoder setup, seeks before setup are applied later
+    struct PendingSeek {
+        int64_t msec;
+        SeekFlag flag;
+        int id;
+    };
+    bool setting_up_ = false;
+    optional<PendingSeek> pending_seek_;
     mutex job_mtx_;
     unique_ptr<R3DSDK::Clip> clip_;
-    R3DSDK::R3DDecoder* dec_ = nullptr;
+    DecoderService::Ptr decoder_; // shared by readers
+    R3DSDK::R3DDecoder* dec_ = nullptr; // decoder_ of this reader
     vector<R3DSDK::R3DDecodeJob*> job_;
-    vector<VideoFrame> frame_; // static frame pool, reduce mem allocation
-    int frame_idx_ = 0; // current frame index in pool
+    FramePool::Ptr pool_ = FramePool::create(); // R3DDecoder and cpu decoder output
+    FramePool::Ptr convert_pool_ = FramePool::create(); // frames of format_ converted from pool_ if R3DSDK can not decode to format_
+    RowWorkers row_workers_{std::clamp<int>(thread::hardware_concurrency() / 2, 1, 8)}; // row bands of a frame graded and converted by output thread
+    size_t pool_max_ = 16; // max frames alive, including decoding ones and frames held by renderer
+    FrameCache cache_; // delivered frames for stepping and scrubbing, holds pool_ buffers
+    size_t cache_mb_ = 0; // opt-in, cached frames also raise the pool budget of every reader
+    MediaInfoCache info_cache_; // skips metadata walk of a reopened clip
+    ProbeOptions info_opts_; // metadata in MediaInfo, others can be queried later
+    bool probe_ = false; // load() only opens the clip and reports MediaInfo
+    thread probe_thread_; // "probe.clips"
+    ImageProcessingPtr ips_; // replaced by load() and "ip.*" properties from any thread
+    vector<pair<string, string>> ip_props_; // "ip.*" properties applied to ips_ on load
+    vector<ImageProcessingPtr> abandoned_ips_; // of debayer jobs not delivered after output thread stopped, until debayer_ is released
+    mutable mutex ips_mtx_;
+    int frame_idx_ = 0; // current job index
 
     bool copy_ = false; // try 0-copy when possible(async/gpu decoder, not R3DDecoder)
-    int gpu_ = OPTION_RED_CUDA|OPTION_RED_OPENCL|OPTION_RED_METAL;
-    Decompress decompress_ = Decompress::R3D; // if not R3D, gpu_ will be set to a supported value
+    int gpu_ = OPTION_RED_CUDA|OPTION_RED_OPENCL|OPTION_RED_METAL; // user setting, masked by supported and loaded runtimes on each load
+    Decompress decompress_opt_ = Decompress::R3D; // user setting
+    Decompress decompress_ = Decompress::R3D; // of current load, may fallback from decompress_opt_
     PixelFormat format_ = PixelFormat::BGRX;
+    PixelFormat decode_format_ = PixelFormat::BGRX; // DecodeFormat(format_, resampled)
     R3DSDK::ImagePipeline ipp_ = R3DSDK::Full_Graded;
     R3DSDK::VideoDecodeMode mode_ = R3DSDK::DECODE_FULL_RES_PREMIUM;
     uint32_t scaleToW_ = 0; // closest down scale to target width
     uint32_t scaleToH_ = 0;
+    uint32_t sizeW_ = 0; // target size
+    uint32_t sizeH_ = 0;
+    Filter filter_ = Filter::None; // if set, frames are resampled to fit in target size, decoded in the smallest mode not less than it
+    uint32_t outW_ = 0; // delivered frame size. scaleToW_ if not resampled
+    uint32_t outH_ = 0;
+    bool convert_ = false; // decoded frames are converted to format_ or resampled to out size
+    Cdl cdl_;
+    string lut_path_;
+    Lut3D::Ptr lut_;
+    Grade::Ptr grade_; // applied to decoded buffers on cpu before conversion
+    uint64_t grade_hash_ = 0;
+    mutable mutex grade_mtx_;
+    // false if loaded decoders can not grade frames enabled later: gpu debayer output or 8bit decoded. grade takes effect on next load
+    atomic<bool> gradable_ = true;
     int64_t duration_ = 0;
     int64_t frames_ = 0;
     atomic<int> seeking_ = 0;
     atomic<uint64_t> index_ = 0; // for stepping frame forward/backward
-    R3DSDK::ImageProcessingSettings ipsettings_;
+    // the last frame delivered when not playing, for interactive grading of a paused frame. a setting change runs debayer again
+    // from raw of decompressors, or grading and conversion from decoded output of R3DDecoder and cpu decoder, instead of decoding
+    struct Kept {
+        uint64_t index = UINT64_MAX;
+        R3DSDK::VideoDecodeMode mode = R3DSDK::DECODE_FULL_RES_PREMIUM;
+        ByteArray raw; // decompressed
+        FramePool::BufferRef decoded; // not graded, pooled. may be the buffer of the delivered frame, which is not modified
+        ImageProcessingPtr ips; // settings of decoded
+    };
+    Kept kept_; // written by output thread
+    mutable mutex kept_mtx_;
+    ByteArray raw_spare_; // swapped with the decompress buffer of a kept frame. output thread only
+    // kept_ is still on screen: delivered and the renderer has not taken a later frame, which blocks in frameAvailable() when paused
+    atomic<bool> still_ = false;
 
     vector<R3DSDK::AsyncDecompressJob*> decompress_job_;
     vector<ByteArray> decompress_buf_;
-    unique_ptr<R3DSDK::AsyncDecoder> async_dec_;
-    unique_ptr<R3DSDK::GpuDecoder> gpu_dec_;
+    MemoryBudget::Lease decompress_lease_; // decompress_buf_
+    R3DSDK::AsyncDecoder* async_dec_ = nullptr;
+    R3DSDK::GpuDecoder* gpu_dec_ = nullptr;
     GpuDebayer::Ptr debayer_;
 
-    vector<R3DSDK::VideoDecodeJob> sw_job_;
+    R3DSDK::VideoDecodeJob sw_job_{}; // parameters of cpu decode jobs, OutputBuffer is set by each worker
+    int sw_threads_count_ = std::clamp<int>(thread::hardware_concurrency() / 4, 1, 8); // DecodeVideoFrame is multithreaded too
+    atomic<bool> sw_running_ = false;
+    vector<thread> sw_threads_;
+    MPMCQueue<UserData> sw_tasks_{64};
+
+    int decode_ahead_ = 4; // R3DDecoder jobs in flight
+    mutex claim_mtx_; // get a free job
+    mutable mutex sched_mtx_;
+    uint32_t gen_ = 0;
+    uint64_t base_ = 0; // 1st index of current generation
+    uint64_t head_ = 0; // next index to deliver
+    uint64_t next_submit_ = 0; // next index to decode
+    UserData seek_; // attached to the task of base_
+    atomic<int> inflight_ = 0; // submitted to R3DDecoder or decompressor and not completed
+    atomic<int> callbacks_ = 0; // running job callbacks. decoders are shared, unload() waits for them instead of closing decoders
+    mutex drain_mtx_;
+    condition_variable drain_cv_; // inflight_ or callbacks_ decreased after output stopped
+    void notifyDrain() {
+        if (output_running_)
+            return;
+        const lock_guard lock(drain_mtx_);
+        drain_cv_.notify_all();
+    }
+    atomic<bool> filling_ = false; // only 1 thread submits at a time
+    atomic<bool> refill_ = false;
+    atomic<bool> refill_wait_ = false;
+
+    // decoded-ahead window: decoded frames waiting for delivery, [head_, head_ + ahead()) are decoding or decoded
+    size_t buffer_frames_ = 0; // target set by user
+    int64_t buffer_ms_ = 0;
+    size_t window_ = 1; // target in frames
+    atomic<size_t> frame_bytes_ = 0;
+    atomic<int> ready_ = 0;
+    atomic<bool> priming_ = false; // window is not filled since load or seek
+
+    // playback clock estimated from delivered frames, for skipping frames can not be delivered in time. guarded by sched_mtx_
+    bool skip_ = true;
+    bool clock_valid_ = false;
+    double clock_index_ = 0; // index presented at clock_time_
+    chrono::steady_clock::time_point clock_time_;
+    atomic<chrono::steady_clock::rep> presenting_ = 0; // when the output thread entered frameAvailable() of a frame, 0 if not in it
+    int marked_seek_ = 0; // seek frame is sent to renderer. output thread only
+
+    // a seek target is decoded by cpu in preview_mode_ and delivered first, then replaced by the frame decoded in mode_
+    R3DSDK::VideoDecodeMode preview_mode_ = R3DSDK::DECODE_FULL_RES_PREMIUM; // disabled if not lower than mode_
+    bool preview_ = false;
+    FramePool::Ptr preview_pool_ = FramePool::create();
+    FramePool::Buffer preview_decoded_; // decode_format_ output if converted to preview_pool_
+    R3DSDK::VideoDecodeJob preview_job_{};
+    atomic<bool> preview_running_ = false;
+    thread preview_thread_;
+    MPMCQueue<UserData> preview_tasks_{2};
+
+    // adaptive decode resolution for R3DDecoder and cpu decoder. modes_[level_] is used for new decodes, a larger level is used if decoding can not keep real time
+    bool adaptive_ = true;
+    vector<R3DSDK::VideoDecodeMode> modes_;
+    atomic<int> level_ = 0;
+    mutable mutex adapt_mtx_;
+    double decode_ms_ = 0; // moving average of decoding time of a frame
+    int slow_ = 0; // continuous samples slower or faster than real time
+    int fast_ = 0;
 
 // need a thread to process output frames. if do it in decode job complete callback, may have dead lock when range loop starts
     atomic<bool> output_running_ = false;
     thread output_thread_;
-    queue<UserData> outputs_;
-    condition_variable output_cv_;
-    mutex output_mtx_;
+    MPMCQueue<UserData> outputs_{64}; // decoded or in-flight frames from decoder callbacks, at most ahead()
+    // decoders request a refill when a job or buffer may be free. submitting from sdk callback threads would reenter the decoder
+    thread fill_thread_;
+    mutex fill_mtx_;
+    condition_variable fill_cv_;
+    bool fill_requested_ = false;
 
     bool enable_video_ = true;
     bool enable_audio_ = true;
     size_t audio_block_size_ = 0;
     size_t audio_blocks_ = 0;
     uint64_t audio_block_duration_ms_ = 0;
-    atomic<int> audio_seeking_ = 0;
-    ByteArray audio_buf_;
-    AudioDecoder::Ptr adec_; // decode s24 be to s32 native
-    MPMCQueue<function<void()>> audio_tasks_; // at most 1 in the queue
+    bool audio_ = false; // audio is set up
+    AudioFormat audio_format_;
+    AudioBufferPool audio_pool_; // decoded blocks, s24 in s32 be is swapped to native in place
+    // audio thread reads blocks ahead into audio_ring_ regardless of delivery, audio output thread delivers them. a seek increases audio_gen_ and blocks of old generations are dropped
+    int64_t audio_ahead_ms_ = 1000;
+    mutex audio_mtx_;
+    condition_variable audio_cv_;
+    atomic<uint32_t> audio_gen_ = 0;
+    size_t audio_next_ = 0; // next block to read
+    int audio_seek_id_ = -1; // carried by the next block
+    unique_ptr<MPMCQueue<AudioBlock>> audio_ring_;
     thread audio_thread_;
-};
-
-
-void to(MediaInfo& info, const R3DSDK::Clip* clip)
-{
-    info.format = "r3d";
+    thread audio_output_thread_;
 
-    info.streams = clip->VideoTrackCount();
-    if (info.streams <= 0)
-        return;
+    // peaks of all audio blocks scanned by another clip at full speed, published as "waveform.*" properties. optionally saved to and loaded from a sidecar file
+    bool waveform_ = false;
+    string waveform_sidecar_; // "1"/"auto": url + ".peaks", empty or "0": disabled
+    atomic<bool> waveform_running_ = false;
+    thread waveform_thread_;
+};
 
-    const auto m = clip->MetadataCount();
-    for (size_t i = 0; i < m; ++i) {
-        auto key = MetadataItemKey(clip, i);
-        auto val = MetadataItemAsString(clip, i);
-        info.metadata.emplace(key, val);
-        free(key);
-        free(val);
-    }
-
-    VideoCodecParameters vcp;
-    vcp.codec = "r3d";
-    vcp.width = clip->Width();
-    vcp.height = clip->Height();
-    vcp.frame_rate = clip->VideoAudioFramerate();
-    VideoStreamInfo vsi;
-    vsi.index = 0;
-    vsi.frames = clip->VideoFrameCount();
-    vsi.duration = vsi.frames * (1000.0 / vcp.frame_rate);
-    vsi.codec = vcp;
-    info.video.reserve(clip->VideoTrackCount());
-    info.video.push_back(vsi);
-    info.duration = vsi.duration;
-
-    if (clip->AudioChannelCount() == 0)
-        return;
-    info.streams++;
-    AudioCodecParameters acp;
-    AudioStreamInfo asi;
-    asi.index = 1;
-    acp.codec = "pcm_s32be";
-    acp.block_align = 8; // why 8?
-    acp.bits_per_raw_sample = 24;
-    acp.bits_per_coded_sample = 32;
-    acp.format = AudioFormat::SampleFormat::S32; // clip->MetadataItemAsInt(RMD_SAMPLE_SIZE) is always 24
-    acp.channels = clip->AudioChannelCount();
-    acp.channel_layout = (uint64_t)clip->MetadataItemAsInt(R3DSDK::RMD_CHANNEL_MASK);
-    acp.sample_rate = clip->MetadataItemAsInt(R3DSDK::RMD_SAMPLERATE); // always 48000
-
-    asi.frames = clip->AudioSampleCount();
-    asi.duration = asi.frames * 1000 / acp.sample_rate;
-    asi.codec = acp;
-    info.audio.reserve(1);
-    info.audio.push_back(asi);
-
-    info.duration = std::max<int64_t>(info.duration, asi.duration);
-}
 
 PixelFormat to(R3DSDK::VideoPixelType fmt)
 {
@@ -255,7 +439,7 @@ R3DSDK::VideoPixelType from(PixelFormat fmt)
     switch (fmt) {
     case PixelFormat::RGBP16: return PixelType_16Bit_RGB_Planar;
     case PixelFormat::RGB48: return PixelType_16Bit_RGB_Interleaved; // NOT RECOMMENDED! 3 channel formats are not directly supported by gpu
-    //case PixelFormat::X2RGB10: return PixelType_10Bit_DPX_MethodB;
+    //case PixelFormat::X2RGB10: return PixelType_10Bit_DPX_MethodB; // DPX word order. converted from RGBP16 instead, see DecodeFormat()
     case PixelFormat::BGRX:
     case PixelFormat::BGRA: return PixelType_8Bit_BGRA_Interleaved;
     case PixelFormat::BGR24: return PixelType_8Bit_BGR_Interleaved;
@@ -294,7 +478,59 @@ static uint32_t Scale(uint32_t x, R3DSDK::VideoDecodeMode mode)
     }
 }
 
-static auto init_sdk()
+// "ip.*" property to ImageProcessingSettings. false if key is unknown or value is invalid
+static bool SetImageProcessing(R3DSDK::ImageProcessingSettings& ips, const string& key, const string& val)
+{
+    const auto v = strtof(val.data(), nullptr);
+    switch (detail::fnv1ah32::hash(key)) {
+    case "ip.exposure"_svh: // stops
+        ips.ExposureAdjust = v;
+        return true;
+    case "ip.kelvin"_svh:
+        ips.Kelvin = v;
+        return true;
+    case "ip.tint"_svh:
+        ips.Tint = v;
+        return true;
+    case "ip.iso"_svh:
+        ips.ISO = (decltype(ips.ISO))v;
+        return true;
+    case "ip.saturation"_svh:
+        ips.Saturation = v;
+        return true;
+    case "ip.contrast"_svh:
+        ips.Contrast = v;
+        return true;
+    case "ip.brightness"_svh:
+        ips.Brightness = v;
+        return true;
+    case "ip.cdl"_svh: { // same as "cdl" property, but applied by R3DSDK
+        Cdl cdl;
+        if (!cdl.parse(val))
+            return false;
+        ips.CdlSlopeRed = cdl.slope[0];
+        ips.CdlSlopeGreen = cdl.slope[1];
+        ips.CdlSlopeBlue = cdl.slope[2];
+        ips.CdlOffsetRed = cdl.offset[0];
+        ips.CdlOffsetGreen = cdl.offset[1];
+        ips.CdlOffsetBlue = cdl.offset[2];
+        ips.CdlPowerRed = cdl.power[0];
+        ips.CdlPowerGreen = cdl.power[1];
+        ips.CdlPowerBlue = cdl.power[2];
+        ips.CdlSaturation = cdl.saturation;
+        ips.CdlEnabled = true;
+    }
+        return true;
+    }
+    return false;
+}
+
+struct SdkInit {
+    R3DSDK::InitializeStatus status;
+    int flags; // OPTION_RED_* loaded
+};
+
+static SdkInit init_sdk()
 {
 #if (__APPLE__ + 0) || (__linux__ + 0)
     // Increase open file limit, because R3D decoder opens /dev/urandom
@@ -336,81 +572,156 @@ static auto init_sdk()
         flags &= ~OPTION_RED_OPENCL;
         ret = R3DSDK::InitializeSdk(sdk_dir.data(), flags);
     }
-    return ret;
+    if (ret == R3DSDK::ISInitializeOK)
+        clog << R3DSDK::GetSdkVersion() << endl;
+    else
+        clog << "R3D InitializeSdk error: " << ret << endl;
+    return {ret, flags};
+}
+
+static once_flag sdk_once;
+static shared_future<SdkInit> sdk_init;
+
+void StartInitSdk()
+{
+    call_once(sdk_once, []{
+        sdk_init = async(launch::async, init_sdk).share();
+    });
+}
+
+R3DSDK::InitializeStatus InitSdk()
+{
+    StartInitSdk();
+    return sdk_init.get().status;
+}
+
+int SdkFlags()
+{
+    StartInitSdk();
+    const auto& sdk = sdk_init.get();
+    return sdk.status == R3DSDK::ISInitializeOK ? sdk.flags : 0;
 }
 
 R3DReader::R3DReader()
     : FrameReader()
 {
-    static const auto ret = init_sdk();
-    init_ = ret == R3DSDK::ISInitializeOK;
-    if (ret != R3DSDK::ISInitializeOK) {
-        clog << "R3D InitializeSdk error: " << ret << endl;
-        return;
-    }
-    clog << R3DSDK::GetSdkVersion() << endl;
+    info_opts_.cache = &info_cache_;
+    StartInitSdk(); // usually started by plugin, wait in load()
 }
 
 bool R3DReader::load()
 {
+    if (!init_)
+        init_ = InitSdk() == R3DSDK::ISInitializeOK;
     if (!init_)
         return false;
+    if (probe_) { // MediaInfo only
+        MediaInfo info;
+        if (!ProbeClip(url(), info, info_opts_))
+            return false;
+        changed(info);
+        update(MediaStatus::Loaded);
+        return true;
+    }
     parseDecoderOptions();
+    updateGrade(); // may be rejected for the previous clip
     enable_video_ &= !activeTracks(MediaType::Video).empty();
     enable_audio_ &= !activeTracks(MediaType::Audio).empty();
 
-    clip_ = make_unique<R3DSDK::Clip>(url().data());
-    if (clip_->Status() != R3DSDK::LoadStatus::LSClipLoaded) {
-        clog << "Load error: " << clip_->Status();
+    if (!openClip())
         return false;
+
+    MediaInfo info;
+    ProbeClip(clip_.get(), url(), info, info_opts_);
+    info.video[0].codec.format = format_;
+    clog << info << endl;
+    duration_ = info.video[0].duration;
+    frames_ = info.video[0].frames;
+    {
+        const lock_guard lock(open_mtx_);
+        setting_up_ = true;
+        pending_seek_.reset();
     }
+    changed(info); // may call seek for player.prepare(), which is delayed until decoder is ready
 
+    setupOutput();
     if (!setupDecoder()) {
         clog << "R3D will use software decoder" << endl;
     }
+    gradable_ = !async_dec_ && !gpu_dec_ && Grade::supports(decode_format_)
+        && decode_format_ != PixelFormat::BGRA && decode_format_ != PixelFormat::BGRX;
 
     if (audio_thread_.joinable())
         audio_thread_.join();
+    if (audio_output_thread_.joinable())
+        audio_output_thread_.join();
     if (output_thread_.joinable())
         output_thread_.join();
+    raw_spare_ = {}; // used by output thread only
+    if (fill_thread_.joinable())
+        fill_thread_.join();
+    output_running_ = true; // before audio threads start
     output_thread_ = thread([this]{
         outputLoop();
     });
+    fill_thread_ = thread([this]{ fillLoop(); });
 
     MediaEvent e{};
     e.category = "decoder.video";
     e.detail = "r3d";
     dispatchEvent(e);
 
- // TODO: change scale when playing
-    if (scaleToW_ > 0 || scaleToH_ > 0) {
-        mode_ = GetScaleMode(scaleToW_, scaleToH_, clip_->Width(), clip_->Height());
-    }
-    scaleToW_ = Scale(clip_->Width(), mode_);
-    scaleToH_ = Scale(clip_->Height(), mode_);
-    clip_->GetDefaultImageProcessingSettings(ipsettings_);
-    ipsettings_.ImagePipelineMode = ipp_;
-    ipsettings_.HdrPeakNits = 1000;
-    ipsettings_.CdlEnabled = true;
-    ipsettings_.OutputToneMap = R3DSDK::ToneMap_None;
+ // mode_ is the best quality. adapt() may choose a lower one when playing
+    modes_ = {mode_};
+    if (adaptive_ && (async_dec_ || gpu_dec_)) // decompress jobs and debayer output are allocated for mode_
+        clog << "R3D adaptive resolution is not supported by decompressors, decode in fixed mode" << endl;
+    if (adaptive_ && !async_dec_ && !gpu_dec_) {
+        for (auto m : {R3DSDK::DECODE_HALF_RES_PREMIUM, R3DSDK::DECODE_QUARTER_RES_GOOD}) {
+            if (Scale(clip_->Width(), m) < Scale(clip_->Width(), modes_.back()))
+                modes_.push_back(m);
+        }
+    }
+    level_ = 0;
+    decode_ms_ = 0;
+    auto ips = make_shared<ImageProcessing>();
+    clip_->GetDefaultImageProcessingSettings(ips->settings);
+    ips->settings.ImagePipelineMode = ipp_;
+    ips->settings.HdrPeakNits = 1000;
+    ips->settings.CdlEnabled = true;
+    ips->settings.OutputToneMap = R3DSDK::ToneMap_None;
+    {
+        const lock_guard lock(ips_mtx_);
+        for (const auto& [key, val] : ip_props_)
+            SetImageProcessing(ips->settings, key, val);
+        ips->hash = detail::fnv1ah64::hash((const char*)&ips->settings, sizeof(ips->settings));
+        ips_ = std::move(ips);
+    }
+    {
+        const lock_guard lock(kept_mtx_);
+        kept_ = {};
+    }
+    still_ = false;
+    cache_.clear();
+    cache_.setCapacity(cache_mb_ << 20);
     //clog << fmt::to_string("clip ImageProcessingSettings: ImagePipelineMode=%d, ExposureAdjust=%f, CdlSaturation=%f, CdlEnabled:%d, OutputToneMap=%d, HdrPeakNits=%u"
-    //    , ipsettings_.ImagePipelineMode, ipsettings_.ExposureAdjust, ipsettings_.CdlSaturation, ipsettings_.CdlEnabled, ipsettings_.OutputToneMap, ipsettings_.HdrPeakNits) << endl;
-
-    MediaInfo info;
-    to(info, clip_.get());
-    info.video[0].codec.format = format_;
-    clog << info << endl;
-    duration_ = info.video[0].duration;
-    frames_ = info.video[0].frames;
+    //    , ips_->settings.ImagePipelineMode, ips_->settings.ExposureAdjust, ips_->settings.CdlSaturation, ips_->settings.CdlEnabled, ips_->settings.OutputToneMap, ips_->settings.HdrPeakNits) << endl;
 
-// parameters are ready, prepare jobs here for seeking+decoding in changed(info)
+// parameters are ready, prepare jobs here for seeking+decoding
+    ready_ = 0;
+    inflight_ = 0;
+    {
+        const lock_guard lock(sched_mtx_);
+        restart(0);
+    }
     setupDecodeJobs();
-    adec_.reset();
+    setupPreview();
+    audio_ = false;
     audio_block_duration_ms_ = 0;
     audio_blocks_ = clip_->AudioBlockCountAndSize(&audio_block_size_);
-    if (audio_blocks_ > 0)
+    if (audio_blocks_ > 0) {
         setupAudio(info.audio[0].codec);
-    changed(info); // may call seek for player.prepare(), duration_, frames_ and SetCallback() must be ready
+        startWaveform();
+    }
     update(MediaStatus::Loaded);
 
     updateBufferingProgress(0);
@@ -418,24 +729,97 @@ bool R3DReader::load()
     if (state() == State::Stopped) // start with pause
         update(State::Running);
 
+    optional<PendingSeek> seek;
+    {
+        const lock_guard lock(open_mtx_);
+        setting_up_ = false;
+        seek = std::exchange(pending_seek_, nullopt);
+    }
+    if (seek)
+        seekTo(seek->msec, seek->flag, seek->id);
     if (seeking_ == 0) {
-        if (adec_)
+        if (audio_)
             readAudioAt(0);
-        if (!readAt(0)) // prepare(pos) will seek in changed(MediaInfo)
+        if (!readAt(0)) // prepare(pos) seeks in changed(MediaInfo)
             return false;
     }
 
     return true;
 }
 
+void R3DReader::setTimeout(int64_t value, TimeoutCallback cb)
+{
+    const lock_guard lock(open_mtx_);
+    timeout_ = value;
+    timeout_cb_ = cb;
+}
+
+bool R3DReader::openClip()
+{
+    auto cancel = make_shared<atomic<bool>>(false);
+    int64_t timeout = 0;
+    TimeoutCallback cb;
+    {
+        const lock_guard lock(open_mtx_);
+        open_cancel_ = cancel;
+        timeout = timeout_;
+        cb = timeout_cb_;
+    }
+    // Clip() can not be interrupted. an abandoned clip is released in the worker
+    auto result = make_shared<promise<unique_ptr<R3DSDK::Clip>>>();
+    auto opened = result->get_future();
+    thread([result, url = string(url())]{
+        result->set_value(make_unique<R3DSDK::Clip>(url.data()));
+    }).detach();
+
+    const auto t0 = chrono::steady_clock::now();
+    auto deadline = timeout;
+    while (opened.wait_for(chrono::milliseconds(10)) != future_status::ready) {
+        if (*cancel) {
+            clog << "R3D open is canceled: " << url() << endl;
+            return false;
+        }
+        const auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - t0).count();
+        if (timeout <= 0 || elapsed < deadline)
+            continue;
+        if (!cb || cb(elapsed)) { // true: abort
+            clog << "R3D open timeout " << elapsed << "ms: " << url() << endl;
+            return false;
+        }
+        deadline += timeout;
+    }
+    auto clip = opened.get();
+    if (clip->Status() != R3DSDK::LoadStatus::LSClipLoaded) {
+        clog << "Load error: " << clip->Status();
+        return false;
+    }
+    if (*cancel)
+        return false;
+    clip_ = std::move(clip);
+    return true;
+}
+
 bool R3DReader::unload()
 {
     {
-        const scoped_lock lock(output_mtx_);
+        const lock_guard lock(open_mtx_);
+        if (open_cancel_)
+            *open_cancel_ = true;
+    }
+    {
+        const lock_guard lock(sched_mtx_); // no submit after this
         output_running_ = false;
-        output_cv_.notify_one();
-        audio_tasks_.notifyAll();
     }
+    outputs_.notifyAll();
+    {
+        const lock_guard lock(fill_mtx_);
+        fill_cv_.notify_all();
+    }
+    if (fill_thread_.joinable()) // no submit after this
+        fill_thread_.join();
+    audio_cv_.notify_all();
+    if (audio_ring_)
+        audio_ring_->notifyAll();
 
     const lock_guard lock(job_mtx_);
     update(MediaStatus::Unloaded);
@@ -446,45 +830,67 @@ bool R3DReader::unload()
     for (auto& job : decompress_job_) {
         job->AbortDecode = true;
     }
-    if (async_dec_) {
-        async_dec_->Close();
-        async_dec_.reset();
-    }
-    if (gpu_dec_) {
-        gpu_dec_->Close();
-        gpu_dec_.reset();
+    // decoders may be used by other readers, jobs, their UserData and buffers are freed only after all callbacks returned
+    {
+        unique_lock lock(drain_mtx_);
+        const auto drained = [this]{ return inflight_ <= 0 && callbacks_ <= 0; };
+        if (!drain_cv_.wait_for(lock, chrono::seconds(5), drained)) {
+            clog << "R3D unload: waiting for " << inflight_ << " decodes" << endl;
+            drain_cv_.wait(lock, drained);
+        }
     }
+    dec_ = nullptr;
+    async_dec_ = nullptr;
+    gpu_dec_ = nullptr;
+    decoder_.reset(); // the last reader closes decoder
     for (auto& job : decompress_job_) {
+        delete (UserData*)job->PrivateData;
         delete job;
         job = nullptr;
     }
     decompress_job_.clear();
+    decompress_buf_.clear();
+    decompress_lease_.reset();
     debayer_.reset();
-
-    if (dec_)
-        R3DSDK::R3DDecoder::ReleaseDecoder(dec_); // FIXME: may block here
-    dec_ = nullptr;
+    {
+        const lock_guard lock(ips_mtx_);
+        abandoned_ips_.clear();
+    }
 
     for (auto j : job_) {
         R3DSDK::R3DDecoder::ReleaseDecodeJob(j);
     }
     job_.clear();
-    sw_job_.clear();
+    stopCpuDecoders();
+    stopPreview();
+    stopWaveform();
+    cache_.clear();
+    {
+        const lock_guard lock(kept_mtx_);
+        kept_ = {}; // holds a pool_ buffer
+    }
+    still_ = false;
+    pool_->clear();
+    convert_pool_->clear();
     clip_.reset();
     frames_ = 0;
+    gradable_ = true;
     update(State::Stopped);
-    { // onJobComplete() after output thread finished
-        const unique_lock lock(output_mtx_);
-        outputs_ = {};
-    }
+    outputs_.clear(); // onJobComplete() after output thread finished
     return true;
 }
 
 bool R3DReader::seekTo(int64_t msec, SeekFlag flag, int id)
 {
+    {
+        const lock_guard lock(open_mtx_);
+        if (setting_up_) {
+            pending_seek_ = PendingSeek{msec, flag, id};
+            return true;
+        }
+    }
     if (!clip_)
         return false;
-    // TODO: cancel running decodeProcessJob
     // TODO: seekCompelete if error later
     if (msec > duration_) // msec can be INT64_MAX, avoid overflow
         msec = duration_;
@@ -507,7 +913,12 @@ bool R3DReader::seekTo(int64_t msec, SeekFlag flag, int id)
 
 int64_t R3DReader::buffered(int64_t* bytes, float* percent) const
 {
-    return 0;
+    const auto n = std::max<int64_t>(ready_, 0);
+    if (bytes)
+        *bytes = n * frame_bytes_;
+    if (percent)
+        *percent = std::min<float>(100.0f, 100.0f * n / window_);
+    return frames_ > 0 ? n * duration_ / frames_ : 0;
 }
 
 bool R3DReader::readAt(uint64_t index, int seekId, SeekFlag flag)
@@ -518,120 +929,251 @@ bool R3DReader::readAt(uint64_t index, int seekId, SeekFlag flag)
     if (!enable_video_)
         return true;
 
-    if (async_dec_ || gpu_dec_) {
-        auto job = getDecompressJob(index);
-        if (!job)
-            return false;
+    return schedule(index, seekId, flag);
+}
+
+size_t R3DReader::depth() const
+{
+    if (dec_)
+        return std::min<size_t>({(size_t)decode_ahead_, job_.size(), (size_t)decoder_->quota()});
+    if (async_dec_ || gpu_dec_)
+        return std::min<size_t>({(size_t)decode_ahead_, decompress_job_.size(), (size_t)decoder_->quota()});
+    return sw_threads_count_;
+}
+
+// keep frames after index decoding or decoded(R3DDecoder jobs or cpu decode tasks). a seek discards frames decoding or queued for old positions
+bool R3DReader::schedule(uint64_t index, int seekId, SeekFlag flag)
+{
+    bool seekWaitFrame = true;
+    uint32_t gen = 0;
+    shared_ptr<atomic<bool>> completed;
+    UserData superseded; // a seek not submitted yet is coalesced into the new one
+    {
+        const lock_guard lock(sched_mtx_);
         if (seekId > 0) {
-            auto data = (UserData*)job->PrivateData;
-            data->seekId = seekId;
-            //data->seekWaitFrame = !test_flag(flag & SeekFlag::IOCompleteCallback); // FIXME:
+            superseded = seek_;
+            restart(index);
+            gen = gen_;
+            seekWaitFrame = !test_flag(flag & SeekFlag::IOCompleteCallback); // completed now instead of by the 1st frame, for all decoders
+            seek_.index = index;
+            seek_.seekId = seekId;
+            seek_.seekWaitFrame = seekWaitFrame;
+            seek_.seekCompleted = completed = make_shared<atomic<bool>>(false);
+        } else if (index > next_submit_) { // stale request from a frame of old generation
+            return true;
         }
-        R3DSDK::DecodeStatus status = R3DSDK::DSDecodeOK;
-        if (async_dec_) {
-            status = async_dec_->DecodeForGpuSdk(*job);
-        } else if (gpu_dec_) {
-            status = gpu_dec_->DecodeForGpuSdk(*job);
+    }
+    if (seekId > 0) {
+        still_ = false; // until the target is delivered
+        drop(superseded);
+        cancel();
+    }
+    if (!seekWaitFrame) { // seek in frameAvailable() and will wait seek finish, dead wait
+        UserData data{};
+        data.index = index;
+        data.seekId = seekId;
+        data.seekCompleted = completed;
+        completeSeek(data);
+    }
+    if (seekId > 0 && preview_ && !cache_.get(cacheKey(index))) {
+        UserData data{};
+        data.reader = this;
+        data.index = index;
+        data.gen = gen;
+        data.seekId = seekId;
+        data.seekCompleted = completed;
+        data.preview = true;
+        preview_tasks_.clear(); // previews of old seeks
+        preview_tasks_.tryPush(std::move(data));
+    }
+    return fill(true);
+}
+
+// called by seek, refresh and fill_thread_. if another thread is filling, it fills again for this request
+bool R3DReader::fill(bool wait)
+{
+    if (wait)
+        refill_wait_ = true;
+    refill_ = true;
+    bool ok = true;
+    while (refill_ && !filling_.exchange(true)) {
+        while (refill_.exchange(false))
+            ok = fillOnce(refill_wait_.exchange(false)) && ok;
+        filling_ = false;
+    }
+    return ok;
+}
+
+void R3DReader::requestFill()
+{
+    {
+        const lock_guard lock(fill_mtx_);
+        fill_requested_ = true;
+    }
+    fill_cv_.notify_one();
+}
+
+void R3DReader::fillLoop()
+{
+    while (output_running_) {
+        {
+            unique_lock lock(fill_mtx_);
+            fill_cv_.wait(lock, [this]{ return fill_requested_ || !output_running_; });
+            fill_requested_ = false;
         }
-        if (status != R3DSDK::DSDecodeOK) {
-            clog << "decompress error: " << status << endl;
-            delete (UserData*)job->PrivateData;
-            job->PrivateData = nullptr;
-            return false;
+        if (output_running_)
+            fill(false);
+    }
+}
+
+// submit [next_submit_, head_ + ahead()). if !wait, stop at the 1st frame without a free job or buffer instead of waiting
+bool R3DReader::fillOnce(bool wait)
+{
+    const bool async = dec_ || async_dec_ || gpu_dec_;
+    vector<UserData> tasks;
+    uint64_t head = 0;
+    {
+        const lock_guard lock(sched_mtx_);
+        if (!output_running_) // unload
+            return true;
+        head = head_;
+        const auto skipTo = skip_ ? deliverable() : 0; // playing behind the clock
+        const auto end = std::min<uint64_t>(std::max(head_, skipTo) + ahead(), frames_);
+        const auto limit = (int)depth();
+        for (auto i = next_submit_; i < end; ++i) {
+            UserData data{};
+            data.reader = this;
+            data.index = i;
+            data.gen = gen_;
+            if (i < skipTo && (i != base_ || seek_.seekId <= 0)) { // keep in order but no sdk work
+                if (i == next_submit_)
+                    clog << "R3D skip frames [" << i << ", " << skipTo << ") behind the clock" << endl;
+                data.skip = true;
+                tasks.push_back(std::move(data));
+                continue;
+            }
+            data.frame = cache_.get(cacheKey(i));
+            data.refresh = !data.frame && refreshable(i);
+            if (async && !data.frame && !data.refresh) {
+                const bool target = i == base_ && seek_.seekId > 0; // seek target does not wait for old generations
+                if (inflight_ >= limit && !target)
+                    break;
+                if (!decoder_->acquire(inflight_, target)) // shared by other readers, retry when a frame is decoded
+                    break;
+                inflight_++;
+            }
+            if (i == base_ && seek_.seekId > 0) {
+                data.seekId = seek_.seekId;
+                data.seekWaitFrame = seek_.seekWaitFrame;
+                data.seekCompleted = seek_.seekCompleted;
+                seek_ = {};
+            }
+            tasks.push_back(std::move(data));
+        }
+        if (!tasks.empty())
+            next_submit_ = std::max(next_submit_, tasks.back().index + 1);
+    }
+    // tasks[k...] are not submitted, decode them later
+    auto rollback = [&](size_t k) {
+        const lock_guard lock(sched_mtx_);
+        if (async) {
+            const auto n = (int)count_if(tasks.begin() + k, tasks.end(), [](const UserData& t) { return !t.frame && !t.skip && !t.refresh; });
+            decoder_->release(n);
+            inflight_ -= n;
+        }
+        notifyDrain();
+        if (gen_ != tasks[k].gen)
+            return;
+        next_submit_ = std::min(next_submit_, tasks[k].index);
+        for (auto i = k; i < tasks.size(); ++i) {
+            if (tasks[i].seekId > 0) {
+                seek_.seekId = tasks[i].seekId;
+                seek_.seekWaitFrame = tasks[i].seekWaitFrame;
+                seek_.seekCompleted = tasks[i].seekCompleted;
+            }
+        }
+    };
+    if (async) {
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            const auto index = tasks[i].index;
+            if (!isCurrent(tasks[i].gen)) { // seek while submitting, skip before decode
+                rollback(i);
+                return true;
+            }
+            if (tasks[i].frame || tasks[i].skip || tasks[i].refresh) { // cache hit, late or kept, no decode
+                push(std::move(tasks[i]));
+                continue;
+            }
+            if (!submit(std::move(tasks[i]), wait)) { // no free job, retry when a frame is delivered
+                rollback(i);
+                return index != head;
+            }
         }
         return true;
     }
-    if (!dec_) {
-        UserData data{};
-        data.swJob = getVideoDecodeJob(index, &data);
-        if (seekId > 0) {
-            data.seekId = seekId;
-            data.seekWaitFrame = !test_flag(flag & SeekFlag::IOCompleteCallback);
-            if (!data.seekWaitFrame) { // seek in frameAvailable() and will wait seek finish, dead wait
-                seeking_--;
-                seekComplete(duration_ * index / frames_, seekId);
+    for (size_t i = 0; i < tasks.size();) {
+        if (tasks[i].frame || tasks[i].skip || tasks[i].refresh) {
+            push(std::move(tasks[i++]));
+            continue;
+        }
+        size_t run = 1; // tasks to decode
+        while (i + run < tasks.size() && !tasks[i + run].frame && !tasks[i + run].skip && !tasks[i + run].refresh)
+            ++run;
+        const auto n = sw_tasks_.tryPushBatch(tasks.begin() + i, run);
+        if (n == 0) {
+            if (!wait) { // full, retry when a frame is decoded
+                rollback(i);
+                return true;
             }
-            const unique_lock lock(output_mtx_);
-            outputs_ = {};
+            if (!sw_tasks_.push(std::move(tasks[i++]))) // full, wait for a worker
+                return false;
+        }
+        i += n;
+    }
+    return true;
+}
+
+bool R3DReader::submit(UserData&& task, bool wait)
+{
+    if (async_dec_ || gpu_dec_) {
+        auto job = getDecompressJob(task);
+        if (!job)
+            return false;
+        auto data = (UserData*)job->PrivateData;
+        const auto status = async_dec_ ? async_dec_->DecodeForGpuSdk(*job) : gpu_dec_->DecodeForGpuSdk(*job);
+        if (status != R3DSDK::DSDecodeOK) {
+            clog << "decompress error: " << status << endl;
+            releaseDecompressJob(data->decompressIndex);
+            return false;
         }
-        push(data);
         return true;
     }
-    auto job = getJob(index);
+    auto job = getJob(task, wait);
     if (!job)
         return false;
-    if (seekId > 0) {
-        auto data = (UserData*)job->privateData;
-        data->seekId = seekId;
-        //data->seekWaitFrame = !test_flag(flag & SeekFlag::IOCompleteCallback); // FIXME:
-    }
-    const auto status = dec_->decode(job);
+    auto data = (UserData*)job->privateData;
+    const auto status = dec_->decode(job); // data may be deleted in callback from now
     if (status != R3DSDK::R3DStatus_Ok) {
         clog << "decode error: " << status << endl;
-        delete (UserData*)job->privateData;
+        delete data;
         job->privateData = nullptr;
         return false;
     }
     return true;
 }
 
+// blocks from index are read. old blocks in ring and being read are dropped
 void R3DReader::readAudioAt(size_t index, int seekId)
 {
-    auto flushTasks = [this]{
-        // DO NOT clear audio_tasks_ directly, execute all to decrease audio_seeking_
-        function<void()> old;
-        while (audio_tasks_.tryPop(old))
-            old();
-    };
-    if (seekId > 0) {
-        audio_seeking_++;
-        // remove old decode tasks, read index + 1 before exectuting decode task by seek
-        flushTasks();
-    }
-    audio_tasks_.push([=,this]{
-        if (seekId > 0) {
-        // remove old decode tasks, read index + 1 before exectuting decode task by seek
-            flushTasks();
-            audio_seeking_--;
-            adec_->flush();
-        }
-        if (audio_seeking_ > 0)
-            return;
-
-        size_t size = audio_buf_.size();
-        if (const auto ret = clip_->DecodeAudioBlock(index, audio_buf_.data(), &size); ret != R3DSDK::DSDecodeOK) {
-            clog << "DecodeAudioBlock error: " << ret << endl;
-            return;
-        }
-        const auto pts = index * audio_block_duration_ms_ / 1000.0;
-        Packet pkt;
-        pkt.type = MediaType::Audio;
-        pkt.duration = 0;   // default -1 is an invalid packet
-        pkt.hasKeyFrame = true;
-        pkt.pts = pkt.dts = pts;
-        pkt.buffer = make_shared<ByteArrayBuffer>(size, audio_buf_.constData());
-        if (adec_->decode(pkt) < 0) {
-            clog << "audio decode error" << endl;
-            return;
-        }
-        AudioFrame frame;
-        if (adec_->take(&frame) < 0) {
-            clog << "R3D NO audio decoded" << endl;
-            return;
-        }
-        if (seekId > 0) {
-            updateBufferingProgress(100); // unpause audio renderer
-            frameAvailable(AudioFrame(frame.format()).setTimestamp(frame.timestamp()));
-        }
-        bool accepted = frameAvailable(frame); // false: out of loop range and begin a new loop
-        if (index == audio_blocks_ - 1 && seeking_ == 0 && accepted) {
-            accepted = frameAvailable(AudioFrame().setTimestamp(TimestampEOS));
-            return;
-        }
-        // frameAvailable() will wait in pause state, and return when seeking, do not read the next index
-        if (accepted && audio_seeking_ == 0 && state() == State::Running && test_flag(mediaStatus() & MediaStatus::Loaded))
-            readAudioAt(index + 1);
-    });
+    {
+        const lock_guard lock(audio_mtx_);
+        audio_gen_++;
+        audio_next_ = index;
+        audio_seek_id_ = seekId;
+    }
+    audio_ring_->clear();
+    audio_ring_->notifyAll(); // wake up audio thread waiting for free space
+    audio_cv_.notify_one();
 }
 
 void R3DReader::setupAudio(const AudioCodecParameters& par)
@@ -639,19 +1181,23 @@ void R3DReader::setupAudio(const AudioCodecParameters& par)
     clog << "Audio blocks: " << audio_blocks_ << ", block size: " << audio_block_size_ << endl;
     if (!enable_audio_)
         return;
-    adec_ = AudioDecoder::create();
-    adec_->set(par);
-    if (!adec_->open()) {
-        adec_.reset();
-        return;
-    }
-    audio_buf_ = ByteArray((int)audio_block_size_, kAudioAlign);
-    AudioFormat af;
-    af.setSampleFormat(par.format)
+    // DecodeAudioBlock() output is s24 in s32 be, interleaved. byte swap is enough, no decoder
+    audio_format_ = AudioFormat();
+    audio_format_.setSampleFormat(par.format)
       .setChannels(par.channels)
       .setSampleRate(par.sample_rate);
-    audio_block_duration_ms_ = af.durationForBytes(audio_block_size_)*1000.0;
+    audio_block_duration_ms_ = audio_format_.durationForBytes(audio_block_size_)*1000.0;
+    const auto ahead = std::max<size_t>(2, audio_block_duration_ms_ > 0 ? (audio_ahead_ms_ + audio_block_duration_ms_ - 1) / audio_block_duration_ms_ : 2);
+    audio_ring_ = make_unique<MPMCQueue<AudioBlock>>(ahead);
+    audio_pool_.reset(audio_block_size_, kAudioAlign, audio_ring_->capacity() + 8 + 2); // + renderer queue + reading and delivering
+    {
+        const lock_guard lock(audio_mtx_);
+        audio_next_ = audio_blocks_; // nothing to read until readAudioAt()
+        audio_seek_id_ = -1;
+    }
+    audio_ = true;
     audio_thread_ = thread([this]{ audioLoop(); });
+    audio_output_thread_ = thread([this]{ audioOutputLoop(); });
 }
 
 void R3DReader::parseDecoderOptions()
@@ -681,70 +1227,103 @@ void R3DReader::parseDecoderOptions()
     }
 }
 
+void R3DReader::setupOutput()
+{
+    const auto W = clip_->Width();
+    const auto H = clip_->Height();
+    if (sizeW_ > 0 || sizeH_ > 0)
+        mode_ = GetScaleMode(sizeW_, sizeH_, W, H);
+    outW_ = outH_ = 0;
+    if (filter_ != Filter::None && sizeW_ > 0 && sizeH_ > 0) { // fit in target size, keep aspect ratio
+        const auto s = std::min({(double)sizeW_ / W, (double)sizeH_ / H, 1.0});
+        outW_ = std::max<uint32_t>(lround(W * s) & ~1, 2); // even for yuv420
+        outH_ = std::max<uint32_t>(lround(H * s) & ~1, 2);
+        mode_ = R3DSDK::DECODE_FULL_RES_PREMIUM;
+        for (auto m : {R3DSDK::DECODE_SIXTEENTH_RES_GOOD, R3DSDK::DECODE_EIGHT_RES_GOOD, R3DSDK::DECODE_QUARTER_RES_GOOD, R3DSDK::DECODE_HALF_RES_PREMIUM}) {
+            if (Scale(W, m) >= outW_ && Scale(H, m) >= outH_) {
+                mode_ = m;
+                break;
+            }
+        }
+    }
+    scaleToW_ = Scale(W, mode_);
+    scaleToH_ = Scale(H, mode_);
+    auto resize = outW_ > 0 && (outW_ != scaleToW_ || outH_ != scaleToH_);
+    if (resize && DecodeFormat(format_, true) != PixelFormat::RGBP16) {
+        clog << "R3D can not resample " << VideoFormat(format_).name() << " frames" << endl;
+        resize = false;
+    }
+    if (!resize) {
+        outW_ = scaleToW_;
+        outH_ = scaleToH_;
+    }
+    decode_format_ = DecodeFormat(format_, resize || grade()); // 8bit output is graded in 16bit
+    convert_ = decode_format_ != format_ || resize;
+}
+
 bool R3DReader::setupDecoder()
 {
-    if (decompress_ == Decompress::Cpu || gpu_ == OPTION_RED_NONE)
+    decompress_ = decompress_opt_;
+    auto gpu = gpu_;
+    if (decompress_ != Decompress::R3D && decompress_ != Decompress::Cpu && convert_) {
+        clog << "R3D gpu debayer can not output " << VideoFormat(format_).name() << " " << outW_ << "x" << outH_ << ", fallback to R3DDecoder" << endl;
+        decompress_ = Decompress::R3D;
+    }
+    if (decompress_ != Decompress::R3D && decompress_ != Decompress::Cpu && grade()) {
+        clog << "R3D gpu debayer output can not be graded, fallback to R3DDecoder" << endl;
+        decompress_ = Decompress::R3D;
+    }
+    if (decompress_ == Decompress::Cpu || gpu == OPTION_RED_NONE)
         return true;
     if (decompress_ == Decompress::R3D) {
-        if (gpu_ & OPTION_RED_METAL)
-            gpu_ &= ~OPTION_RED_METAL;
+        gpu &= ~OPTION_RED_METAL;
 #if (__APPLE__ + 0)
-        if (gpu_ & OPTION_RED_CUDA)
-            gpu_ &= ~OPTION_RED_CUDA;
+        gpu &= ~OPTION_RED_CUDA;
 #endif
     }
 
     if (decompress_ != Decompress::R3D) {
-        debayer_ = GpuDebayer::create(gpu_);
+        debayer_ = GpuDebayer::create(gpu);
+        if (!debayer_) {
+            clog << "R3D no gpu debayer for decompressor, fallback to R3DDecoder" << endl;
+            decompress_ = Decompress::R3D;
+        }
     }
     if (decompress_ == Decompress::Gpu) {
         if (auto ret = R3DSDK::GpuDecoder::DecodeSupportedForClip(*clip_.get()); ret != R3DSDK::DSDecodeOK) {
             clog << ret << " R3DSDK::GpuDecoder does not support current clip, fallback to AsyncDecoder" << endl;
             decompress_ = Decompress::Async;
-        } else {
-            gpu_dec_ = make_unique<R3DSDK::GpuDecoder>();
-            gpu_dec_->Open();
+        } else if ((decoder_ = DecoderService::get(DecoderService::Gpu))) {
+            gpu_dec_ = decoder_->gpu();
             return true;
+        } else {
+            clog << "R3D GpuDecoder is not available, fallback to AsyncDecoder" << endl;
+            decompress_ = Decompress::Async;
         }
     }
     if (decompress_ == Decompress::Async) {
-        async_dec_ = make_unique<R3DSDK::AsyncDecoder>();
-        async_dec_->Open();
-        return true;
-    }
-
-    if (gpu_ == OPTION_RED_NONE)
-        gpu_ = OPTION_RED_OPENCL;
-
-    R3DSDK::R3DDecoderOptions *options = nullptr;
-    R3DSDK::R3DStatus status = R3DSDK::R3DDecoderOptions::CreateOptions(&options);
-    if (status != R3DSDK::R3DStatus_Ok) {
-        clog << "R3DDecoderOptions::CreateOptions error: " << status << endl;
-        return false;
+        if ((decoder_ = DecoderService::get(DecoderService::Async))) {
+            async_dec_ = decoder_->async();
+            return true;
+        }
+        clog << "R3D AsyncDecoder is not available, fallback to R3DDecoder" << endl;
+        decompress_ = Decompress::R3D;
+        debayer_.reset();
     }
-    // TODO:
-    options->setMemoryPoolSize(4096);           // 1024+
-    options->setGPUMemoryPoolSize(4096);        // 1024+
-    options->setGPUConcurrentFrameCount(1);     // 1~3
-    //options->setScratchFolder("");            //empty string disables scratch folder. c++ abi
-    options->setDecompressionThreadCount(0);    //cores - 1 is good if you are a gui based app.
-    options->setConcurrentImageCount(0);        //threads to process images/manage state of image processing.
-    //options->useRRXAsync(true); // removed in 8.6
 
-    status = SetupCudaCLDevices(options, gpu_);
-    if (status != R3DSDK::R3DStatus_Ok) {
-        clog << "Setup Cuda/OpenCL Devices error: " << status << endl;
+    if (gpu == OPTION_RED_NONE)
+        gpu = OPTION_RED_OPENCL;
+    if (const auto loaded = SdkFlags(); (gpu & loaded) == 0) {
+        clog << "R3D runtime of gpu " << gpu << " is not loaded, loaded: " << loaded << endl;
         return false;
+    } else {
+        gpu &= loaded;
     }
 
-    status = R3DSDK::R3DDecoder::CreateDecoder(options, &dec_);
-
-    R3DSDK::R3DDecoderOptions::ReleaseOptions(options);
-    if (status != R3DSDK::R3DStatus_Ok) {
-        clog << "R3DDecoder::CreateDecoder error: " << status << endl;
+    decoder_ = DecoderService::get(DecoderService::R3D, gpu);
+    if (!decoder_)
         return false;
-    }
-
+    dec_ = decoder_->r3d();
     return true;
 }
 
@@ -752,91 +1331,123 @@ void R3DReader::setupDecodeJobs()
 {
     if (!enable_video_)
         return;
-    const int simultaneousJobs = 8; // frame queue size in renderer is 4
+    constexpr size_t kMaxJobs = 8; // frame queue size in renderer is 4. less if memory budget is tight
+    window_ = buffer_frames_;
+    if (buffer_ms_ > 0 && duration_ > 0)
+        window_ = std::max<size_t>(window_, (buffer_ms_ * frames_ + duration_ - 1) / duration_);
+    window_ = std::clamp<size_t>(window_, 1, kMaxWindow);
     if (async_dec_ || gpu_dec_) {
-        decompress_buf_.resize(simultaneousJobs);
-        for (int i = 0; i < simultaneousJobs; ++i) {
+        R3DSDK::AsyncDecompressJob params; // for output size
+        params.Clip = clip_.get();
+        params.Mode = mode_;
+        params.VideoFrameNo = 0;
+        params.VideoTrackNo = 0;
+        size_t outSize = 0;
+        if (decompress_ == Decompress::Async) {
+            outSize = R3DSDK::AsyncDecoder::GetSizeBufferNeeded(params);
+        } else {
+            outSize = R3DSDK::GpuDecoder::GetSizeBufferNeeded(params);
+        }
+        if (outSize == 0) {
+            clog << "Failed to get decompress job output buffer size" << endl;
+            return;
+        }
+        const auto jobs = MemoryBudget::instance().depth(outSize, 2, kMaxJobs);
+        decompress_buf_.resize(jobs);
+        decompress_lease_.reset(jobs * outSize);
+        for (size_t i = 0; i < jobs; ++i) {
             auto job = new R3DSDK::AsyncDecompressJob();
             job->Clip = clip_.get();
             job->Mode = mode_;
             job->VideoFrameNo = 0;
             job->VideoTrackNo = 0;
             job->AbortDecode = false;
-            size_t outSize = 0;
-            if (decompress_ == Decompress::Async) {
-                outSize = R3DSDK::AsyncDecoder::GetSizeBufferNeeded(*job);
-            } else {
-                outSize = R3DSDK::GpuDecoder::GetSizeBufferNeeded(*job);
-            }
-            if (outSize == 0) {
-                clog << "Failed to get decompress job output buffer size" << endl;
-                return;
-            }
             decompress_buf_[i] = ByteArray(outSize);
             job->OutputBuffer = decompress_buf_[i].data();
             job->OutputBufferSize = outSize;
             job->Callback = [](R3DSDK::AsyncDecompressJob* job, R3DSDK::DecodeStatus decodeStatus) {
-                auto data = (UserData*)job->PrivateData;
-                data->reader->onJobComplete(job, decodeStatus);
+                auto reader = ((UserData*)job->PrivateData)->reader;
+                reader->callbacks_++;
+                reader->onJobComplete(job, decodeStatus);
+                reader->callbacks_--;
+                reader->notifyDrain();
             };
             decompress_job_.push_back(job);
         }
+        window_ = std::min<size_t>(window_, decompress_job_.size()); // decompress job is released after debayer output is delivered
+        frame_bytes_ = VideoFormat(format_).bytesPerFrame(scaleToW_, scaleToH_);
         return;
     }
 
-    frame_.resize(simultaneousJobs);
-    for (int i = 0; i < simultaneousJobs; ++i) {
-        VideoFrame frame(scaleToW_, scaleToH_, format_);
-        frame.setBuffers(nullptr); // requires 16bytes aligned. already 64bytes aligned
-        frame_[i] = frame;
+    // buffers requires 16bytes aligned. already 64bytes aligned
+    pool_->reset(scaleToW_, scaleToH_, decode_format_);
+    const size_t decoding = dec_ ? MemoryBudget::instance().depth(pool_->bytesPerFrame(), 2, kMaxJobs) : sw_threads_count_;
+    frame_bytes_ = VideoFormat(format_).bytesPerFrame(outW_, outH_);
+    const auto cached = frame_bytes_ > 0 ? cache_.capacity() / frame_bytes_ : 0;
+    const auto alive = std::max<size_t>(pool_max_, std::max<size_t>(decoding, window_) + 4) + cached; // + renderer queue + cache_
+    if (convert_) { // decoded buffers are released after conversion
+        convert_pool_->reset(outW_, outH_, format_);
+        convert_pool_->setBudget(2, alive);
+        pool_->setBudget(decoding, std::max<size_t>(decoding, window_) + 2);
+    } else {
+        pool_->setBudget(decoding, alive);
     }
     if (!dec_) {
-        for (int i = 0; i < simultaneousJobs; ++i) {
-            R3DSDK::VideoDecodeJob job{};
-            job.Mode = mode_;
-            job.PixelType = from(format_);
-            const auto& frame = frame_[i];
-            job.OutputBuffer = frame.buffer()->data();
-            //job.BytesPerRow = frame.buffer()->stride(); // removed in 8.6
-            job.OutputBufferSize = frame.format().bytesPerFrame(scaleToW_, scaleToH_);
-            job.ImageProcessing = &ipsettings_;
-            sw_job_.push_back(std::move(job));
-        }
+        sw_job_ = {};
+        sw_job_.Mode = mode_;
+        sw_job_.PixelType = from(decode_format_);
+        sw_job_.OutputBuffer = nullptr; // leased from pool_ for each decode
+        //sw_job_.BytesPerRow = frame.buffer()->stride(); // removed in 8.6
+        sw_job_.OutputBufferSize = pool_->bytesPerFrame();
+        sw_job_.ImageProcessing = nullptr; // snapshot of each decode
+        startCpuDecoders();
         return;
     }
-    for (int i = 0; i < simultaneousJobs; ++i) {
+    for (size_t i = 0; i < decoding; ++i) {
         R3DSDK::R3DDecodeJob *job = nullptr;
         R3DSDK::R3DDecoder::CreateDecodeJob(&job);
         job->clip = clip_.get();
         job->mode = mode_;
-        job->pixelType = from(format_);
-        const auto& frame = frame_[i];
-        job->bytesPerRow = frame.buffer()->stride();
-        job->outputBuffer = frame.buffer()->data();
-        job->outputBufferSize = frame.format().bytesPerFrame(scaleToW_, scaleToH_);
+        job->pixelType = from(decode_format_);
+        job->bytesPerRow = pool_->bytesPerLine();
+        job->outputBuffer = nullptr; // leased from pool_ for each decode
+        job->outputBufferSize = pool_->bytesPerFrame();
         job->privateData = nullptr;
         job->videoFrameNo = 0;
         job->videoTrackNo = 0;
-        job->imageProcessingSettings = &ipsettings_;
+        job->imageProcessingSettings = nullptr; // snapshot of each decode
         job->callback = [](R3DSDK::R3DDecodeJob *job, R3DSDK::R3DStatus status) {
-            auto data = (UserData*)job->privateData;
-            data->reader->onJobComplete(job, status);
+            auto reader = ((UserData*)job->privateData)->reader;
+            reader->callbacks_++; // data is deleted in onJobComplete()
+            reader->onJobComplete(job, status);
+            reader->callbacks_--;
+            reader->notifyDrain();
         };
         job_.push_back(job);
     }
 }
 
-R3DSDK::R3DDecodeJob* R3DReader::getJob(size_t index)
+R3DSDK::R3DDecodeJob* R3DReader::getJob(const UserData& task, bool wait)
 {
+    const lock_guard lock(claim_mtx_); // output thread and seekTo()
     for (size_t i = 0; i < job_.size(); ++i) {
         auto n = (i + frame_idx_) % job_.size();
         auto j = job_[n];
         if (!j->privateData) {
-            j->videoFrameNo = index;
-            auto data = new UserData();
-            data->reader = this;
-            data->index = index;
-            data->frame = frame_[n];
+            auto buf = pool_->acquire(wait ? kFrameBufferTimeout : chrono::milliseconds(0));
+            if (!buf)
+                return nullptr;
+            j->videoFrameNo = task.index;
+            j->mode = decodeMode(*buf); // buffer size may be changed by adapt()
+            j->bytesPerRow = VideoFormat(buf->format).bytesPerLine(buf->width, 0);
+            j->outputBuffer = buf->data.data();
+            j->outputBufferSize = buf->data.size();
+            auto data = new UserData(task);
+            data->mode = j->mode;
+            data->start = chrono::steady_clock::now();
+            data->buffer = std::move(buf);
+            data->ips = imageProcessing();
+            j->imageProcessingSettings = const_cast<R3DSDK::ImageProcessingSettings*>(&data->ips->settings); // read only by R3DSDK
             j->privateData = data;
             frame_idx_++;
             return j;
@@ -849,41 +1460,41 @@ void R3DReader::onJobComplete(R3DSDK::R3DDecodeJob *job, R3DSDK::R3DStatus statu
 {
     auto data = (UserData*)job->privateData;
     if (status != R3DSDK::R3DStatus_Ok) {
-
+        clog << "R3DDecoder error: " << status << endl;
+        data->buffer.reset(); // keep in order but not displayed
+    } else {
+        adapt(data->mode, data->start);
     }
-
-    updateBufferingProgress(100);
-
+    // may complete out of order. index_ and End are updated when delivered in order
     const auto index = data->index;
     const auto seekId = data->seekId;
     const auto seekWaitFrame = data->seekWaitFrame;
-    if (index == frames_ - 1) {
-        update(MediaStatus::Loaded|MediaStatus::End); // Options::ContinueAtEnd
-    }
-
-    index_ = index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
     if (seekId > 0 && seekWaitFrame) {
-        seeking_--;
-        seekComplete(duration_ * index / frames_, seekId); // may create a new seek
+        index_ = index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
+        completeSeek(*data); // may create a new seek
     }
 
-    push(*data);
-
+    auto out = std::move(*data);
     delete data;
-    job->privateData = nullptr;
-
+    job->privateData = nullptr; // free for the next frame
+    decoder_->release();
+    inflight_--;
+    push(std::move(out));
 }
 
-R3DSDK::AsyncDecompressJob* R3DReader::getDecompressJob(size_t index)
+// task generation is set with the claim, so cancel() never aborts a job of the current generation
+R3DSDK::AsyncDecompressJob* R3DReader::getDecompressJob(const UserData& task)
 {
+    const lock_guard lock(claim_mtx_);
     for (size_t i = 0; i < decompress_job_.size(); ++i) {
         auto n = (i + frame_idx_) % decompress_job_.size();
         auto j = decompress_job_[n];
         if (!j->PrivateData) {
-            j->VideoFrameNo = index;
-            auto data = new UserData();
-            data->reader = this;
-            data->index = index;
+            j->VideoFrameNo = task.index;
+            j->AbortDecode = false;
+            auto data = new UserData(task);
+            data->mode = mode_;
+            data->start = chrono::steady_clock::now();
             data->decompressIndex = n;
             j->PrivateData = data;
             frame_idx_++;
@@ -893,67 +1504,194 @@ R3DSDK::AsyncDecompressJob* R3DReader::getDecompressJob(size_t index)
     return nullptr;
 }
 
+// decompress_buf_[i] is reusable only after the debayer job created from it is done
+void R3DReader::releaseDecompressJob(size_t i)
+{
+    const lock_guard lock(claim_mtx_);
+    if (i >= decompress_job_.size())
+        return;
+    auto j = decompress_job_[i];
+    delete (UserData*)j->PrivateData;
+    j->PrivateData = nullptr;
+}
+
 void R3DReader::onJobComplete(R3DSDK::AsyncDecompressJob *job, R3DSDK::DecodeStatus status)
 {
-    auto data = (UserData*)job->PrivateData;
-    const auto index = data->index;
-    const auto seekId = data->seekId;
-    const auto seekWaitFrame = data->seekWaitFrame;
-    const auto bufIdx = data->decompressIndex;
-    job->PrivateData = nullptr; // TODO: when debayer done
+    // job is still owned by data until released in process() or drop()
+    auto data = *(UserData*)job->PrivateData;
+    decoder_->release();
+    inflight_--;
+    const auto index = data.index;
+    const auto seekId = data.seekId;
+    const auto seekWaitFrame = data.seekWaitFrame;
+    const auto bufIdx = data.decompressIndex;
+    if (!isCurrent(data.gen)) { // seek while decompressing, skip debayer
+        releaseDecompressJob(bufIdx);
+        drop(data);
+        return;
+    }
     if (status != R3DSDK::DSDecodeOK) { // abort by user
         clog << "Decompress error: " << status << endl;
-        delete data;
+        releaseDecompressJob(bufIdx);
+        push(std::move(data)); // keep in order but not displayed
         return;
     }
-    if (index == frames_ - 1) {
-        update(MediaStatus::Loaded|MediaStatus::End); // Options::ContinueAtEnd
-    }
 
-    index_ = index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
     if (seekId > 0 && seekWaitFrame) {
-        seeking_--;
-        seekComplete(duration_ * index / frames_, seekId); // may create a new seek
+        index_ = index; // update index_ before seekComplete because pending seek may be executed in seekCompleted
+        completeSeek(data); // may create a new seek
     }
 
-    auto debayerJob = debayer_->createJob(decompress_buf_[bufIdx].constData(), decompress_buf_[bufIdx].size(), scaleToW_, scaleToH_, mode_, from(format_), &ipsettings_);
+    data.ips = imageProcessing(); // debayer applies image processing
+    auto debayerJob = debayer_->createJob(decompress_buf_[bufIdx].constData(), decompress_buf_[bufIdx].size(), scaleToW_, scaleToH_, mode_, from(format_), const_cast<R3DSDK::ImageProcessingSettings*>(&data.ips->settings));
     if (!debayerJob) {
         clog << "Failed to create a debayer job" << endl;
-        delete data;
+        releaseDecompressJob(bufIdx);
+        push(std::move(data));
         return;
     }
     debayer_->submit(debayerJob);
 
-    data->debayerJob = debayerJob;
-    push(*data);
-
-    delete data;
+    data.debayerJob = debayerJob;
+    push(std::move(data)); // output thread waits debayer in order. no free decompress job if output is blocked, so decompress stops
+}
 
-    //readAt(index + 1); // TODO:
+// decoded frames are counted in the window until delivered or dropped
+void R3DReader::push(UserData&& data)
+{
+    size_t target = 0;
+    if ((data.buffer || data.debayerJob || data.frame || data.refresh) && !data.preview) {
+        const lock_guard lock(sched_mtx_);
+        if (data.gen == gen_) {
+            data.ready = true;
+            target = std::min<uint64_t>(window_, frames_ - base_);
+        }
+    }
+    if (data.ready)
+        ready_++;
+    // unload() stops output thread first, a full queue is never drained then. decoders drop results instead of blocking forever
+    while (!outputs_.push(std::move(data), chrono::milliseconds(100))) {
+        if (!output_running_) {
+            if (data.ready)
+                ready_--;
+            data.buffer.reset(); // debayer jobs and decompress buffers are released by unload(), which holds job_mtx_
+            if (data.debayerJob) { // settings of the job
+                const lock_guard lock(ips_mtx_);
+                abandoned_ips_.push_back(std::move(data.ips));
+            }
+            return;
+        }
+    }
+    if (target > 0 && priming_) {
+        const auto n = (size_t)std::max<int>(ready_, 0);
+        if (n >= target) {
+            if (priming_.exchange(false))
+                updateBufferingProgress(100);
+        } else {
+            updateBufferingProgress(int(n * 100 / target));
+        }
+    }
+    requestFill(); // a job or buffer may be available now
 }
 
-void R3DReader::process(const UserData& data)
+void R3DReader::process(UserData& data)
 {
     const auto index = data.index;
     const auto seekId = data.seekId;
     const auto seekWaitFrame = data.seekWaitFrame;
-    VideoFrame frame;
-    if (data.debayerJob) {
-        const lock_guard lock(job_mtx_); // debayer_ reset in unload() after wait done
-        frame = debayer_->wait(data.debayerJob, copy_);
-        debayer_->releaseJob(data.debayerJob);
-    } else if (data.swJob) {
-        const lock_guard lock(job_mtx_);
-        if (!clip_)
-            return;
-        clip_->DecodeVideoFrame(data.index, *data.swJob);
-        frame = data.frame;
-        if (seekId > 0 && seekWaitFrame) {
-            seeking_--;
-            seekComplete(duration_ * index / frames_, seekId); // may create a new seek
+    if (data.ready)
+        ready_--;
+    if (!data.preview) {
+        const lock_guard lock(sched_mtx_);
+        if (data.gen == gen_)
+            head_ = std::max(head_, index + 1);
+    }
+    if (data.skip) {
+        if (seeking_ == 0 && state() == State::Running && test_flag(mediaStatus() & MediaStatus::Loaded))
+            readAt(index + 1);
+        return;
+    }
+    VideoFrame frame = data.frame; // cache hit or preview
+    bool kept = false; // frame is kept_
+    if (!frame) {
+        if (data.refresh)
+            restore(data);
+        // a seek or step target is shown when paused, the last frame stays at the end. the kept index decoded again has new settings
+        bool keep = !data.refresh && !data.preview && (seekId > 0 || index == frames_ - 1);
+        if (!keep && !data.refresh && !data.preview) {
+            const lock_guard lock(kept_mtx_);
+            keep = kept_.index == index;
         }
-    } else {
-        frame = data.frame;
+        kept = data.refresh;
+        if (keep && data.buffer) { // a reference, not copied
+            const lock_guard lock(kept_mtx_);
+            if (raw_spare_.isEmpty())
+                raw_spare_ = std::move(kept_.raw);
+            kept_ = {};
+            kept_.index = data.index;
+            kept_.mode = data.mode;
+            kept_.decoded = data.buffer;
+            kept_.ips = data.ips;
+            kept = true;
+        }
+        uint64_t gradeHash = 0;
+        const auto grade = this->grade(&gradeHash);
+        if (data.buffer && grade && Grade::supports(data.buffer->format)) {
+            if (kept) { // kept_ is not graded
+                auto graded = pool_->acquire(chrono::milliseconds(0)); // output thread does not wait for decoders
+                if (!graded || graded->format != data.buffer->format || graded->width != data.buffer->width || graded->height != data.buffer->height) {
+                    graded = make_shared<FramePool::Buffer>(*data.buffer); // adapted size or no free buffer, not pooled
+                    graded->data = ByteArray(data.buffer->data.size());
+                }
+                grade->apply(*data.buffer, *graded, &row_workers_);
+                data.buffer = std::move(graded);
+            } else {
+                grade->apply(*data.buffer, &row_workers_);
+            }
+        }
+        if (data.debayerJob) {
+            const lock_guard lock(job_mtx_); // debayer_ reset in unload() after wait done
+            frame = debayer_->wait(data.debayerJob, copy_);
+            debayer_->releaseJob(data.debayerJob);
+            if (keep && frame) { // swapped with the spare buffer of the decompress job, not copied
+                const lock_guard kept_lock(kept_mtx_);
+                auto& raw = decompress_buf_[data.decompressIndex];
+                if (raw_spare_.size() != raw.size())
+                    raw_spare_ = ByteArray(raw.size()); // once unless the kept frame is replaced by a decoded one
+                auto old = std::move(kept_.raw); // not used by a debayer job, restored ones are done
+                kept_ = {};
+                kept_.index = data.index;
+                kept_.mode = data.mode;
+                kept_.raw = std::move(raw);
+                raw = std::move(raw_spare_);
+                raw_spare_ = std::move(old);
+                decompress_job_[data.decompressIndex]->OutputBuffer = raw.data(); // job is not released yet
+                kept = true;
+            }
+            releaseDecompressJob(data.decompressIndex);
+            if (frame)
+                adapt(data.mode, data.start);
+        } else if (convert_) {
+            frame = convert(data.buffer);
+            data.buffer.reset(); // back to pool_ for decoding
+        } else {
+            frame = pool_->frame(data.buffer);
+        }
+        if (MemoryBudget::instance().pressure()) // cached frames hold pool_ or convert_pool_ buffers
+            cache_.clear();
+        else if (frame)
+            cache_.put(cacheKey(index, data.mode, (data.ips ? data.ips->hash : 0) ^ gradeHash), frame, frame_bytes_);
+    }
+    if (index == frames_ - 1 && !data.preview) {
+        update(MediaStatus::Loaded|MediaStatus::End); // Options::ContinueAtEnd
+    }
+    index_ = index;
+    completeSeek(data); // decoded by cpu, or preview. may create a new seek
+    if (!frame) {
+        clog << "R3D failed to decode frame index@" << index << endl;
+        if (!data.preview && seeking_ == 0 && state() == State::Running && test_flag(mediaStatus() & MediaStatus::Loaded))
+            readAt(index + 1);
+        return;
     }
 
     if (seekId == 0 && seeking_ > 0 && seekWaitFrame) { // ?
@@ -963,10 +1701,24 @@ void R3DReader::process(const UserData& data)
 
     frame.setTimestamp(double(duration_ * index / frames_) / 1000.0);
     frame.setDuration((double)duration_/(double)frames_ / 1000.0);
-    if (seekId > 0) {
+    if (seekId > 0 && seekId != marked_seek_) { // once for preview and decoded frames
+        marked_seek_ = seekId;
         frameAvailable(VideoFrame(frame.format()).setTimestamp(frame.timestamp()));
     }
+    const auto begin = chrono::steady_clock::now();
+    presenting_ = begin.time_since_epoch().count();
     bool accepted = frameAvailable(frame); // false: out of loop range and begin a new loop
+    presenting_ = 0;
+    if (data.preview) // decoded frame of the same index is the next
+        return;
+    const auto end = chrono::steady_clock::now();
+    if (seekId > 0 || kept) {
+        still_ = kept && accepted;
+    } else if (accepted && end - begin >= chrono::microseconds(duration_ * 500 / frames_) && still_.exchange(false)) { // blocked by renderer, an earlier frame is presented
+        const lock_guard lock(kept_mtx_);
+        kept_.decoded.reset(); // back to pool_ when playing
+    }
+    updateClock(data, begin, end);
     if (index == frames_ - 1 && seeking_ == 0 && accepted) {
         accepted = frameAvailable(VideoFrame().setTimestamp(TimestampEOS));
         if (accepted && !test_flag(options() & Options::ContinueAtEnd)) {
@@ -982,36 +1734,626 @@ void R3DReader::process(const UserData& data)
         readAt(index + 1);
 }
 
+uint64_t R3DReader::deliverable() const
+{
+    if (!clock_valid_ || frames_ <= 0)
+        return 0;
+    const double frameMs = (double)duration_ / (double)frames_;
+    const auto now = chrono::steady_clock::now();
+    // blocked by renderer longer than a frame: paused or ahead, the clock does not run. it is anchored again when frameAvailable() returns
+    if (const auto since = presenting_.load(); since != 0
+        && chrono::duration<double, milli>(now - chrono::steady_clock::time_point(chrono::steady_clock::duration(since))).count() > frameMs)
+        return 0;
+    double cost = 0;
+    {
+        const lock_guard lock(adapt_mtx_);
+        cost = decode_ms_;
+    }
+    const auto ms = chrono::duration<double, milli>(now - clock_time_).count() + cost;
+    const auto index = clock_index_ + ms / frameMs;
+    return std::min<uint64_t>((uint64_t)std::ceil(index), frames_ - 1); // EOS is sent by the last frame
+}
+
+// frameAvailable() blocks if renderer is ahead or paused, then the frame is presented about now and the clock is anchored again, e.g. on resume.
+// otherwise the clock keeps running from the last anchor. a seek or step invalidates it in restart()
+void R3DReader::updateClock(const UserData& data, chrono::steady_clock::time_point begin, chrono::steady_clock::time_point end)
+{
+    const double frameMs = (double)duration_ / (double)frames_;
+    const lock_guard lock(sched_mtx_);
+    if (data.gen != gen_ || state() != State::Running) {
+        clock_valid_ = false;
+        return;
+    }
+    if (clock_valid_ && chrono::duration<double, milli>(end - begin).count() < frameMs / 2)
+        return;
+    clock_valid_ = true;
+    clock_index_ = (double)data.index;
+    clock_time_ = end;
+}
+
+// discard a frame superseded by a new seek. the seek carried by the frame is still completed
+void R3DReader::drop(UserData& data)
+{
+    if (data.ready) {
+        data.ready = false;
+        ready_--;
+    }
+    if (data.debayerJob) {
+        const lock_guard lock(job_mtx_);
+        if (debayer_) {
+            debayer_->wait(data.debayerJob);
+            debayer_->releaseJob(data.debayerJob);
+        }
+        data.debayerJob = nullptr;
+        releaseDecompressJob(data.decompressIndex);
+    }
+    data.buffer.reset();
+    if (!data.preview) // the seek is completed by the decoded frame
+        completeSeek(data);
+}
+
+// a seek is completed once, by the 1st delivered frame of preview and decoded ones, or a drop
+bool R3DReader::completeSeek(UserData& data)
+{
+    if (data.seekId <= 0 || !data.seekCompleted || data.seekCompleted->exchange(true))
+        return false;
+    seeking_--;
+    seekComplete(duration_ * data.index / frames_, data.seekId);
+    return true;
+}
+
+// decompress jobs of old generations are aborted. R3DDecoder jobs can not be aborted, but tasks not submitted yet are skipped in fillOnce().
+// cpu tasks of old generations are dropped by workers before decoding
+void R3DReader::cancel()
+{
+    if (!async_dec_ && !gpu_dec_)
+        return;
+    uint32_t gen = 0;
+    {
+        const lock_guard lock(sched_mtx_);
+        gen = gen_;
+    }
+    const lock_guard lock(claim_mtx_);
+    for (auto j : decompress_job_) {
+        if (auto data = (UserData*)j->PrivateData; data && data->gen != gen)
+            j->AbortDecode = true;
+    }
+}
+
+R3DSDK::VideoDecodeMode R3DReader::decodeMode(const FramePool::Buffer& buf) const
+{
+    for (auto m : modes_) {
+        if ((int)Scale(clip_->Width(), m) == buf.width)
+            return m;
+    }
+    return mode_;
+}
+
+// decoded buffer to format_ and out size, resampled if "size" differs from decoded size
+VideoFrame R3DReader::convert(const FramePool::BufferRef& buf)
+{
+    if (!buf)
+        return {};
+    // resampled frames are always of out size, otherwise decoded size may be adapted
+    const bool resize = outW_ != scaleToW_ || outH_ != scaleToH_;
+    const int w = resize ? (int)outW_ : buf->width;
+    const int h = resize ? (int)outH_ : buf->height;
+    if (convert_pool_->width() != w || convert_pool_->height() != h)
+        convert_pool_->reset(w, h, format_);
+    auto out = convert_pool_->acquire(kFrameBufferTimeout);
+    if (!out || !ConvertFrame(*buf, *out, &row_workers_, filter_))
+        return {};
+    return convert_pool_->frame(out);
+}
+
+bool R3DReader::refreshable(uint64_t index) const
+{
+    const lock_guard lock(kept_mtx_);
+    if (kept_.index != index)
+        return false;
+    if (!kept_.raw.isEmpty())
+        return true;
+    const auto ips = imageProcessing();
+    return kept_.decoded && kept_.ips && ips && kept_.ips->hash == ips->hash;
+}
+
+void R3DReader::restore(UserData& data)
+{
+    const lock_guard lock(kept_mtx_);
+    if (kept_.index != data.index)
+        return;
+    data.mode = kept_.mode;
+    data.start = chrono::steady_clock::now();
+    if (!kept_.raw.isEmpty()) { // kept_ is replaced only by output thread after the job is done
+        data.ips = imageProcessing();
+        data.debayerJob = debayer_->createJob(kept_.raw.constData(), kept_.raw.size(), scaleToW_, scaleToH_, mode_, from(format_), const_cast<R3DSDK::ImageProcessingSettings*>(&data.ips->settings));
+        data.decompressIndex = SIZE_MAX; // no decompress job to release
+        if (!data.debayerJob)
+            clog << "Failed to create a debayer job" << endl;
+        else
+            debayer_->submit(data.debayerJob);
+    } else if (kept_.decoded) { // graded into another buffer in process()
+        data.buffer = kept_.decoded;
+        data.ips = kept_.ips;
+    }
+}
+
+void R3DReader::refresh()
+{
+    if (!clip_ || !enable_video_ || !still_ || seeking_ > 0)
+        return;
+    uint64_t index = UINT64_MAX;
+    {
+        const lock_guard lock(kept_mtx_);
+        index = kept_.index;
+    }
+    if (index == UINT64_MAX)
+        return;
+    // processed again from kept_ if possible, otherwise decoded again with new settings, e.g. "ip.*" of decoded output
+    {
+        const lock_guard lock(sched_mtx_);
+        restart(index);
+    }
+    cancel();
+    fill(true);
+}
+
+Grade::Ptr R3DReader::grade(uint64_t* hash) const
+{
+    const lock_guard lock(grade_mtx_);
+    if (hash)
+        *hash = grade_hash_;
+    return grade_;
+}
+
+R3DReader::ImageProcessingPtr R3DReader::imageProcessing() const
+{
+    const lock_guard lock(ips_mtx_);
+    return ips_;
+}
+
+void R3DReader::updateGrade()
+{
+    auto grade = Grade::create(cdl_, lut_);
+    uint64_t hash = 0;
+    if (grade) { // cached frames of other settings are not hit
+        hash = detail::fnv1ah64::hash((const char*)&cdl_, sizeof(cdl_));
+        hash ^= detail::fnv1ah64::hash(lut_path_.data(), lut_path_.size()) * 31;
+    }
+    const lock_guard lock(grade_mtx_);
+    grade_ = std::move(grade);
+    grade_hash_ = hash;
+}
+
+// decoding time of a frame in mode is recorded for skipping frames, and compared with frame duration. the mode of new decodes is changed if it is slow for a while, or fast enough to decode in a higher quality mode
+void R3DReader::adapt(R3DSDK::VideoDecodeMode mode, chrono::steady_clock::time_point start)
+{
+    constexpr int kSlowSamples = 8;
+    constexpr int kFastSamples = 48;
+    constexpr double kUpCost = 3.0; // decoding time of a higher mode
+    if (modes_.empty() || duration_ <= 0 || seeking_ > 0 || state() != State::Running)
+        return;
+    const double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    const double frameMs = (double)duration_ / (double)frames_;
+    int level = -1;
+    double avg = 0;
+    {
+        const lock_guard lock(adapt_mtx_);
+        const auto cur = level_.load();
+        if (mode != modes_[cur]) // decoded before level change
+            return;
+        decode_ms_ = decode_ms_ > 0 ? decode_ms_ * 0.9 + ms * 0.1 : ms;
+        if (modes_.size() < 2)
+            return;
+        const auto cost = decode_ms_ / (double)depth(); // frames are decoded in parallel
+        if (cost > frameMs * 0.9) {
+            fast_ = 0;
+            if (++slow_ >= kSlowSamples && cur + 1 < (int)modes_.size())
+                level = cur + 1;
+        } else if (cost * kUpCost < frameMs * 0.8) {
+            slow_ = 0;
+            if (++fast_ >= kFastSamples && cur > 0)
+                level = cur - 1;
+        } else {
+            slow_ = fast_ = 0;
+        }
+        if (level < 0)
+            return;
+        slow_ = fast_ = 0;
+        avg = decode_ms_;
+        decode_ms_ = 0;
+        level_ = level;
+    }
+    // new buffers are allocated for new size. old buffers in use are released when returned
+    const auto m = modes_[level];
+    pool_->reset(Scale(clip_->Width(), m), Scale(clip_->Height(), m), decode_format_);
+    if (outW_ == scaleToW_ && outH_ == scaleToH_) // not resampled, convert_pool_ follows decoded size in convert()
+        frame_bytes_ = VideoFormat(format_).bytesPerFrame(pool_->width(), pool_->height());
+    clog << fmt::to_string("R3D decode time %.1fms, frame duration %.1fms. decode mode %d => %d", avg, frameMs, mode, m) << endl;
+}
+
 void R3DReader::audioLoop()
 {
     while (output_running_) {
-        function<void()> task;
-        if (!audio_tasks_.pop(task))
+        AudioBlock block;
+        {
+            unique_lock lock(audio_mtx_);
+            if (!audio_cv_.wait_for(lock, chrono::milliseconds(100), [this]{ return !output_running_ || audio_next_ < audio_blocks_; }))
+                continue;
+            if (!output_running_)
+                break;
+            block.index = audio_next_++;
+            block.gen = audio_gen_;
+            block.seekId = std::exchange(audio_seek_id_, -1);
+        }
+        block.buffer = audio_pool_.acquire();
+        size_t size = block.buffer->capacity();
+        if (const auto ret = clip_->DecodeAudioBlock(block.index, block.buffer->data(), &size); ret != R3DSDK::DSDecodeOK) {
+            clog << "DecodeAudioBlock error: " << ret << endl;
+            block.buffer.reset(); // still delivered to keep seek state
+        } else {
+            ByteSwap32(block.buffer->data(), size / 4);
+            block.buffer->setSize(size);
+        }
+        // wait for free space. false if woken up by seek or unload
+        while (output_running_ && block.gen == audio_gen_ && !audio_ring_->push(std::move(block))) {}
+    }
+}
+
+void R3DReader::audioOutputLoop()
+{
+    while (output_running_) {
+        AudioBlock block;
+        if (!audio_ring_->pop(block, chrono::milliseconds(100)))
+            continue;
+        if (block.gen != audio_gen_) // seek
+            continue;
+        const auto pts = block.index * audio_block_duration_ms_ / 1000.0;
+        if (block.seekId > 0) {
+            updateBufferingProgress(100); // unpause audio renderer
+            frameAvailable(AudioFrame(audio_format_).setTimestamp(pts));
+        }
+        if (!block.buffer)
+            continue;
+        const auto size = block.buffer->size();
+        AudioFrame frame(audio_format_);
+        frame.setSamplesPerChannel(int(size / audio_format_.bytesPerFrame()));
+        frame.addBuffer(std::move(block.buffer));
+        frame.setTimestamp(pts);
+        // frameAvailable() will wait in pause state, and return when seeking. blocks are still read ahead
+        const bool accepted = frameAvailable(frame); // false: out of loop range and begin a new loop
+        if (block.index == audio_blocks_ - 1 && seeking_ == 0 && accepted)
+            frameAvailable(AudioFrame().setTimestamp(TimestampEOS));
+    }
+}
+
+void R3DReader::startWaveform()
+{
+    stopWaveform();
+    if (!waveform_)
+        return;
+    auto path = waveform_sidecar_ == "0" ? string() : waveform_sidecar_;
+    if (path == "1" || path == "auto")
+        path = string(url()) + ".peaks";
+    waveform_running_ = true;
+    waveform_thread_ = thread([this, url = string(url()), path]{ buildWaveform(url, path); });
+}
+
+void R3DReader::stopWaveform()
+{
+    waveform_running_ = false;
+    if (waveform_thread_.joinable())
+        waveform_thread_.join();
+}
+
+void R3DReader::buildWaveform(const string& url, const string& path)
+{
+    MediaEvent e{};
+    e.category = "r3d.waveform";
+    e.detail = path; // sidecar, peaks are in "waveform.*" properties
+    e.error = -1;
+    // own clip, no video decoding and not blocked by playback
+    R3DSDK::Clip clip(url.data());
+    const int channels = (int)clip.AudioChannelCount();
+    size_t blockSize = 0;
+    const auto blocks = clip.AudioBlockCountAndSize(&blockSize);
+    if (clip.Status() != R3DSDK::LoadStatus::LSClipLoaded || channels <= 0 || blocks == 0) {
+        dispatchEvent(e);
+        return;
+    }
+    const int sampleRate = (int)clip.MetadataItemAsInt(R3DSDK::RMD_SAMPLERATE);
+    // a sidecar of a modified or another clip is rebuilt
+    error_code ec;
+    const uint64_t fileSize = filesystem::file_size(url, ec);
+    const int64_t mtime = filesystem::last_write_time(url, ec).time_since_epoch().count();
+    const uint64_t samples = clip.AudioSampleCount();
+    auto fingerprint = detail::fnv1ah64::hash((const char*)&fileSize, sizeof(fileSize));
+    fingerprint = detail::fnv1ah64::hash((const char*)&mtime, sizeof(mtime), fingerprint);
+    fingerprint = detail::fnv1ah64::hash((const char*)&samples, sizeof(samples), fingerprint);
+
+    Waveform wf;
+    if (!path.empty() && wf.load(path.data(), channels, sampleRate, fingerprint)) {
+        clog << "R3D waveform loaded from " << path << endl;
+        publishWaveform(wf);
+        e.error = 0;
+        dispatchEvent(e);
+        return;
+    }
+    const auto t0 = chrono::steady_clock::now();
+    wf.reset(channels, sampleRate, fingerprint);
+    ByteArray buf((int)blockSize, kAudioAlign);
+    for (size_t i = 0; i < blocks; ++i) {
+        if (!waveform_running_) // unload
+            return;
+        size_t size = blockSize;
+        if (const auto ret = clip.DecodeAudioBlock(i, buf.data(), &size); ret != R3DSDK::DSDecodeOK) {
+            clog << "R3D waveform DecodeAudioBlock error: " << ret << endl;
+            dispatchEvent(e);
+            return;
+        }
+        ByteSwap32(buf.data(), size / 4);
+        wf.add((const int32_t*)buf.constData(), size / 4 / channels);
+    }
+    wf.finish();
+    publishWaveform(wf);
+    e.error = 0;
+    if (!path.empty() && !wf.save(path.data()))
+        clog << "R3D waveform failed to save " << path << endl;
+    clog << fmt::to_string("R3D waveform %d blocks, %d levels in %dms", (int)blocks, wf.levels(), (int)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - t0).count()) << endl;
+    dispatchEvent(e);
+}
+
+void R3DReader::publishWaveform(const Waveform& wf)
+{
+    setProperty("waveform.levels", to_string(wf.levels()));
+    setProperty("waveform.channels", to_string(wf.channels()));
+    for (int i = 0; i < wf.levels(); ++i) {
+        const auto& peaks = wf.peaks(i);
+        setProperty("waveform." + to_string(i), string((const char*)peaks.data(), peaks.size() * sizeof(peaks[0])));
+    }
+}
+
+// MediaInfo of clips not opened yet are saved in info_cache_, so they load fast later. an "r3d.probe" event for each clip
+void R3DReader::probeClips(const string& paths)
+{
+    if (probe_thread_.joinable())
+        probe_thread_.join();
+    vector<string> list;
+    for (size_t begin = 0; begin < paths.size();) {
+        auto end = paths.find(';', begin);
+        if (end == string::npos)
+            end = paths.size();
+        if (end > begin)
+            list.emplace_back(paths, begin, end - begin);
+        begin = end + 1;
+    }
+    if (list.empty())
+        return;
+    if (info_cache_.dir().empty())
+        clog << "R3D probe.clips without info.cache, results are not kept" << endl;
+    probe_thread_ = thread([this, list = std::move(list), opts = info_opts_]{
+        const auto results = ProbeClips(list, opts);
+        for (size_t i = 0; i < results.size(); ++i) {
+            MediaEvent e{};
+            e.category = "r3d.probe";
+            e.detail = list[i];
+            e.error = results[i].ok ? 0 : -1;
+            dispatchEvent(e);
+        }
+    });
+}
+
+void R3DReader::queryMetadata(const string& prefix)
+{
+    vector<pair<string, string>> items;
+    {
+        const lock_guard lock(job_mtx_); // clip_ reset in unload()
+        if (!clip_)
+            return;
+        const auto m = clip_->MetadataCount();
+        for (size_t i = 0; i < m; ++i) {
+            if (!MetadataItemKeyStartsWith(clip_.get(), i, prefix.data()))
+                continue;
+            auto key = MetadataItemKey(clip_.get(), i);
+            auto val = MetadataItemAsString(clip_.get(), i);
+            items.emplace_back(key, val);
+            free(key);
+            free(val);
+        }
+    }
+    for (const auto& [key, val] : items)
+        setProperty("metadata." + key, val);
+}
+
+void R3DReader::cpuDecodeLoop()
+{
+    while (sw_running_) {
+        UserData data;
+        if (!sw_tasks_.pop(data, chrono::milliseconds(100)))
+            continue;
+        if (!isCurrent(data.gen)) {
+            drop(data);
             continue;
-        task();
+        }
+        // an empty buffer is still pushed to keep frames in order
+        data.buffer = pool_->acquire(kFrameBufferTimeout);
+        if (data.buffer) {
+            auto job = sw_job_;
+            job.Mode = data.mode = decodeMode(*data.buffer);
+            job.OutputBuffer = data.buffer->data.data();
+            job.OutputBufferSize = data.buffer->data.size();
+            data.ips = imageProcessing();
+            job.ImageProcessing = const_cast<R3DSDK::ImageProcessingSettings*>(&data.ips->settings);
+            data.start = chrono::steady_clock::now();
+            if (const auto ret = clip_->DecodeVideoFrame(data.index, job); ret != R3DSDK::DSDecodeOK) {
+                clog << "DecodeVideoFrame error: " << ret << endl;
+                data.buffer.reset();
+            } else {
+                adapt(data.mode, data.start);
+            }
+        }
+        push(std::move(data));
+    }
+}
+
+void R3DReader::startCpuDecoders()
+{
+    sw_running_ = true;
+    for (int i = 0; i < sw_threads_count_; ++i)
+        sw_threads_.emplace_back([this]{ cpuDecodeLoop(); });
+}
+
+void R3DReader::stopCpuDecoders()
+{
+    sw_running_ = false;
+    sw_tasks_.notifyAll();
+    pool_->clear(); // wake up workers waiting for buffers
+    for (auto& t : sw_threads_)
+        t.join();
+    sw_threads_.clear();
+    sw_tasks_.popAll([this](UserData&& data) { drop(data); });
+}
+
+void R3DReader::setupPreview()
+{
+    stopPreview();
+    const auto w = Scale(clip_->Width(), preview_mode_);
+    const auto h = Scale(clip_->Height(), preview_mode_);
+    preview_ = enable_video_ && w < scaleToW_;
+    if (!preview_)
+        return;
+    preview_pool_->reset(w, h, format_);
+    preview_pool_->setBudget(1, 4);
+    preview_decoded_ = {};
+    if (decode_format_ != format_) {
+        preview_decoded_.width = w;
+        preview_decoded_.height = h;
+        preview_decoded_.format = decode_format_;
+        preview_decoded_.data = ByteArray(VideoFormat(decode_format_).bytesPerFrame(w, h));
+    }
+    preview_job_ = {};
+    preview_job_.Mode = preview_mode_;
+    preview_job_.PixelType = from(decode_format_);
+    preview_job_.OutputBufferSize = VideoFormat(decode_format_).bytesPerFrame(w, h);
+    preview_job_.ImageProcessing = nullptr; // snapshot of each decode
+    preview_running_ = true;
+    preview_thread_ = thread([this]{ previewLoop(); });
+}
+
+void R3DReader::stopPreview()
+{
+    preview_running_ = false;
+    preview_tasks_.notifyAll();
+    preview_pool_->clear();
+    if (preview_thread_.joinable())
+        preview_thread_.join();
+    preview_tasks_.clear();
+}
+
+void R3DReader::previewLoop()
+{
+    while (preview_running_) {
+        UserData data;
+        if (!preview_tasks_.pop(data, chrono::milliseconds(100)))
+            continue;
+        if (!isCurrent(data.gen))
+            continue;
+        auto buf = preview_pool_->acquire(kFrameBufferTimeout);
+        if (!buf)
+            continue;
+        auto job = preview_job_;
+        const auto ips = imageProcessing();
+        job.ImageProcessing = const_cast<R3DSDK::ImageProcessingSettings*>(&ips->settings);
+        job.OutputBuffer = preview_decoded_.data.isEmpty() ? buf->data.data() : preview_decoded_.data.data();
+        if (const auto ret = clip_->DecodeVideoFrame(data.index, job); ret != R3DSDK::DSDecodeOK) {
+            clog << "R3D preview DecodeVideoFrame error: " << ret << endl;
+            continue;
+        }
+        auto& decoded = preview_decoded_.data.isEmpty() ? *buf : preview_decoded_;
+        if (const auto grade = this->grade(); grade && Grade::supports(decoded.format))
+            grade->apply(decoded);
+        if (!preview_decoded_.data.isEmpty() && !ConvertFrame(preview_decoded_, *buf))
+            continue;
+        data.frame = preview_pool_->frame(buf);
+        if (isCurrent(data.gen)) // output thread drops it if the decoded frame is delivered
+            push(std::move(data));
     }
 }
 
 void R3DReader::outputLoop()
 {
-    output_running_ = true;
+    // decoders may complete out of order, deliver frames in index order of current generation
+    ReorderBuffer<UserData> reorder(outputs_.capacity());
+    uint32_t gen = 0;
+    auto dropFrame = [this](UserData&& data) { drop(data); };
     while (output_running_) {
         UserData data;
         if (!pop(data))
             continue;
-        process(data);
+        uint64_t base = 0;
+        if (!isCurrent(data.gen, &base)) {
+            drop(data);
+            continue;
+        }
+        if (data.gen != gen) {
+            gen = data.gen;
+            reorder.reset(base, dropFrame);
+        }
+        if (data.preview) {
+            if (data.index == reorder.next()) // decoded frame is not delivered yet
+                process(data);
+            else
+                drop(data);
+            continue;
+        }
+        if (!reorder.put(data.index, std::move(data))) {
+            clog << "R3D unexpected frame index@" << data.index << ", expect " << reorder.next() << endl;
+            drop(data);
+            continue;
+        }
+        while (output_running_ && reorder.take(data)) {
+            if (!isCurrent(data.gen)) { // seek while delivering previous frames
+                drop(data);
+                continue;
+            }
+            process(data);
+        }
     }
-    const unique_lock lock(output_mtx_);
-    outputs_ = {};
+    reorder.reset(0, dropFrame);
+    outputs_.popAll(dropFrame);
     clog << "R3D finish output loop" << endl;
 }
 
 void R3DReader::onPropertyChanged(const std::string& key, const std::string& val)
 {
+    if (key.starts_with("ip.")) { // ImageProcessingSettings, e.g. "ip.exposure", "ip.kelvin". applied to new decodes, or the paused frame is processed again
+        {
+            const lock_guard lock(ips_mtx_); // jobs of old settings still use their snapshot
+            auto ips = make_shared<ImageProcessing>();
+            if (ips_)
+                *ips = *ips_;
+            if (!SetImageProcessing(ips->settings, key, val)) {
+                clog << "R3D unsupported image processing setting " << key << "=" << val << endl;
+                return;
+            }
+            erase_if(ip_props_, [&](const auto& kv) { return kv.first == key; });
+            ip_props_.emplace_back(key, val);
+            ips->hash = detail::fnv1ah64::hash((const char*)&ips->settings, sizeof(ips->settings));
+            ips_ = std::move(ips);
+        }
+        if (!clip_)
+            return;
+        refresh();
+        return;
+    }
     const auto k = detail::fnv1ah32::hash(key);
     switch (k) {
-    case "format"_svh:
+    case "format"_svh: // decoded by R3DSDK, or converted from RGBP16
         format_ = VideoFormat::fromName(val.data());
+        if (from(DecodeFormat(format_)) == R3DSDK::PixelType_8Bit_BGRA_Interleaved && format_ != PixelFormat::BGRA && format_ != PixelFormat::BGRX) {
+            clog << "R3D unsupported output format " << val << ", fallback to bgrx" << endl;
+            format_ = PixelFormat::BGRX;
+        }
         return;
     case "gpu"_svh: {
         if ("auto"sv == val) { // metal > cuda > opencl > cpu
@@ -1030,14 +2372,82 @@ void R3DReader::onPropertyChanged(const std::string& key, const std::string& val
     case "copy"_svh:
         copy_ = stoi(val) > 0;
         return;
+    case "pool"_svh: // max decoded frames alive
+        pool_max_ = std::max(stoi(val), 1);
+        return;
+    case "depth"_svh: // R3DDecoder decode-ahead frames
+        decode_ahead_ = std::clamp(stoi(val), 1, 8);
+        return;
+    case "threads"_svh: // cpu decode threads, also frames decoding in parallel
+        sw_threads_count_ = std::clamp(stoi(val), 1, 32);
+        return;
+    case "cache"_svh: // decoded frame cache size in MB for stepping and scrubbing, 0(default) to disable
+        cache_mb_ = std::max(stoi(val), 0);
+        return;
+    case "skip"_svh: // skip frames can not be decoded in time when playing
+        skip_ = stoi(val) > 0;
+        return;
+    case "audio.buffer"_svh: // audio read-ahead in ms
+        audio_ahead_ms_ = std::max(stoll(val), 0LL);
+        return;
+    case "probe"_svh: // no decoding, load() only reports MediaInfo
+        probe_ = stoi(val) > 0;
+        return;
+    case "metadata"_svh: // metadata in MediaInfo: "all"(default), "none", or comma separated key prefixes
+        info_opts_.setMetadata(val);
+        return;
+    case "probe.clips"_svh: // ';' separated clip paths probed in parallel in background, MediaInfo is kept in "info.cache"
+        probeClips(val);
+        return;
+    case "metadata.query"_svh: // key prefix. matched items are set as properties "metadata.key"
+        queryMetadata(val);
+        return;
+    case "info.cache"_svh: // MediaInfo cache directory, "1"/"auto": temp dir. empty or "0": disabled
+        if (val == "1" || val == "auto") {
+            error_code ec;
+            info_cache_.setDir((filesystem::temp_directory_path(ec) / "mdk-r3d").string());
+        } else {
+            info_cache_.setDir(val == "0" ? string() : val);
+        }
+        return;
+    case "waveform"_svh: // build audio peaks on load, "1" or "0". properties "waveform.levels", "waveform.channels", and "waveform.N": level N as
+        // packed native float {min, max, rms} of each channel, Waveform::kSamplesPerPeak frames per level 0 peak, Waveform::kLevelScale peaks per higher level peak
+        waveform_ = stoi(val) > 0;
+        return;
+    case "waveform.sidecar"_svh: // peaks file to load instead of scanning and to save after, "1"/"auto": url + ".peaks", empty or "0"(default): disabled
+        waveform_sidecar_ = val;
+        return;
+    case "adaptive"_svh: // lower decode resolution if decoding is slower than real time
+        adaptive_ = stoi(val) > 0;
+        return;
+    case "preview"_svh: // 1/8, 1/16: show a low resolution frame first on seek. 0: disabled
+        if (val.starts_with("1/")) {
+            preview_mode_ = atoi(&val[2]) >= 12 ? R3DSDK::DECODE_SIXTEENTH_RES_GOOD : R3DSDK::DECODE_EIGHT_RES_GOOD;
+        } else {
+            preview_mode_ = R3DSDK::DECODE_FULL_RES_PREMIUM;
+        }
+        return;
+    case "buffer"_svh: // decoded-ahead window. frames, or duration with suffix "ms" or "s"
+        if (val.ends_with("ms")) {
+            buffer_ms_ = std::max<int64_t>(stoll(val), 0);
+            buffer_frames_ = 0;
+        } else if (val.ends_with('s')) {
+            buffer_ms_ = std::max<int64_t>(int64_t(stod(val) * 1000.0), 0);
+            buffer_frames_ = 0;
+        } else {
+            buffer_frames_ = std::max(stoi(val), 0);
+            buffer_ms_ = 0;
+        }
+        return;
     case "scale"_svh: // 1/2, 1/4, 1/8, 1/16
     case "size"_svh: { // widthxheight or width(height=width)
         if (val.contains('x')) { // closest scale to target resolution
             char* s = nullptr;
-            scaleToW_ = strtoul(val.data(), &s, 10);
+            sizeW_ = strtoul(val.data(), &s, 10);
             if (s && s[0] == 'x')
-                scaleToH_ = strtoul(s + 1, nullptr, 10);
+                sizeH_ = strtoul(s + 1, nullptr, 10);
         } else if (val.starts_with("1/")) { // closest scale to target resolution
+            sizeW_ = sizeH_ = 0;
             auto s = atoi(&val[2]);
             if (s >= 12)
                 mode_ = R3DSDK::DECODE_SIXTEENTH_RES_GOOD;
@@ -1050,11 +2460,43 @@ void R3DReader::onPropertyChanged(const std::string& key, const std::string& val
             else
                 mode_ = R3DSDK::DECODE_FULL_RES_PREMIUM;
         } else {
-            scaleToW_ = strtoul(val.data(), nullptr, 10);
-            scaleToH_ = scaleToW_;
+            sizeW_ = strtoul(val.data(), nullptr, 10);
+            sizeH_ = sizeW_;
         }
     }
         return;
+    case "resample"_svh: // exact "size" from the closest larger decode mode: "bilinear"(or 1), "lanczos", 0(default)
+        if (val == "lanczos")
+            filter_ = Filter::Lanczos;
+        else if (val == "bilinear" || val == "1")
+            filter_ = Filter::Bilinear;
+        else
+            filter_ = Filter::None;
+        return;
+    case "lut"_svh: // .cube 3D LUT applied on cpu after decoding, e.g. show LUT with "ipp=primary". empty or "0": disabled
+        lut_path_ = val == "0" ? string() : val;
+        lut_ = lut_path_.empty() ? nullptr : Lut3D::load(lut_path_);
+        if (!lut_path_.empty() && !lut_)
+            lut_path_.clear();
+        if (!gradable_ && (lut_ || !cdl_.identity())) { // keep ungraded output until reload
+            clog << "R3D lut and cdl can not be applied by current decoder, take effect on next load" << endl;
+            return;
+        }
+        updateGrade();
+        refresh();
+        return;
+    case "cdl"_svh: // ASC CDL on cpu before "lut": "sr sg sb or og ob pr pg pb sat". empty or "0": disabled
+        if (!cdl_.parse(val)) {
+            clog << "R3D invalid cdl: " << val << endl;
+            cdl_ = {};
+        }
+        if (!gradable_ && (lut_ || !cdl_.identity())) { // keep ungraded output until reload
+            clog << "R3D lut and cdl can not be applied by current decoder, take effect on next load" << endl;
+            return;
+        }
+        updateGrade();
+        refresh();
+        return;
     case "ipp"_svh:
     case "image_pipeline"_svh: {
         if (val.contains("primary"))
@@ -1066,13 +2508,13 @@ void R3DReader::onPropertyChanged(const std::string& key, const std::string& val
     case "decompress"_svh: {
         // gpu(4GB gpu vram, fallback to async/r3d if not supported DecodeSupportedForClip), async, r3d, rocket
         if (val == "async")
-            decompress_ = Decompress::Async;
+            decompress_opt_ = Decompress::Async;
         else if (val == "gpu")
-            decompress_ = Decompress::Gpu;
+            decompress_opt_ = Decompress::Gpu;
         else if (val == "cpu")
-            decompress_ = Decompress::Cpu;
+            decompress_opt_ = Decompress::Cpu;
         else
-            decompress_ = Decompress::R3D;
+            decompress_opt_ = Decompress::R3D;
     }
         return;
     case "decoder"_svh:
@@ -1087,6 +2529,7 @@ MDK_NS_END
 
 MDK_PLUGIN(r3d) {
     using namespace MDK_NS;
+    StartInitSdk(); // InitializeSdk() loads runtime libraries, readers wait for it only in load()
     FrameReader::registerOnce("R3D", []{return new R3DReader();});
     FrameReader::registerOnce("NEV", []{return new R3DReader();});
     return MDK_ABI_VERSION;
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// Restores index order of items completed out of order. Single thread, no allocation after construction.
+// Only indices in [next(), next() + capacity()) can be put.
+template <typename T>
+class ReorderBuffer
+{
+public:
+    explicit ReorderBuffer(size_t capacity = 64) : slots_(capacity) {}
+
+    // expect index next, call f(T&&) for each item discarded
+    template<typename F>
+    void reset(uint64_t next, F&& f) {
+        for (auto& s : slots_) {
+            if (s) {
+                f(std::move(*s));
+                s.reset();
+            }
+        }
+        next_ = next;
+        count_ = 0;
+    }
+
+    // false if index is out of window or already exists, and t is untouched
+    bool put(uint64_t index, T&& t) {
+        if (index < next_ || index >= next_ + slots_.size())
+            return false;
+        auto& s = slots_[index % slots_.size()];
+        if (s)
+            return false;
+        s.emplace(std::move(t));
+        count_++;
+        return true;
+    }
+
+    // take the item of next() if exists and advance next()
+    bool take(T& t) {
+        auto& s = slots_[next_ % slots_.size()];
+        if (!s)
+            return false;
+        t = std::move(*s);
+        s.reset();
+        count_--;
+        next_++;
+        return true;
+    }
+
+    uint64_t next() const { return next_; }
+    size_t size() const { return count_; }
+    size_t capacity() const { return slots_.size(); }
+private:
+    std::vector<std::optional<T>> slots_;
+    uint64_t next_ = 0;
+    size_t count_ = 0;
+};
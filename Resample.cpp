@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "Resample.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+constexpr float kPi = 3.14159265358979f;
+constexpr int kLanczosLobes = 3;
+
+static float Kernel(Filter filter, float x)
+{
+    x = fabs(x);
+    if (filter == Filter::Lanczos) {
+        if (x < 1e-6f)
+            return 1.0f;
+        if (x >= kLanczosLobes)
+            return 0.0f;
+        const auto px = kPi * x;
+        return kLanczosLobes * sin(px) * sin(px / kLanczosLobes) / (px * px);
+    }
+    return x < 1.0f ? 1.0f - x : 0.0f;
+}
+
+FilterTaps MakeTaps(int srcSize, int dstSize, Filter filter)
+{
+    FilterTaps t;
+    if (srcSize <= 0 || dstSize <= 0)
+        return t;
+    const auto scale = float(srcSize) / float(dstSize);
+    const auto stretch = std::max(scale, 1.0f);
+    const auto support = (filter == Filter::Lanczos ? kLanczosLobes : 1.0f) * stretch;
+    t.taps = std::min((int)ceil(support * 2.0f) + 1, srcSize);
+    t.stride = (t.taps + 7) & ~7;
+    t.start.resize(dstSize);
+    t.weights.assign((size_t)dstSize * t.stride, 0.0f);
+    for (int i = 0; i < dstSize; ++i) {
+        const auto center = (float(i) + 0.5f) * scale - 0.5f;
+        const auto lo = (int)floor(center - support) + 1;
+        const auto start = std::clamp(lo, 0, srcSize - t.taps);
+        auto w = &t.weights[(size_t)i * t.stride];
+        float sum = 0;
+        for (int j = lo; j < lo + t.taps; ++j) { // edge pixels are repeated
+            const auto v = Kernel(filter, (float(j) - center) / stretch);
+            w[std::clamp(j, 0, srcSize - 1) - start] += v;
+            sum += v;
+        }
+        if (sum != 0.0f) {
+            for (int k = 0; k < t.taps; ++k)
+                w[k] /= sum;
+        }
+        t.start[i] = start;
+    }
+    return t;
+}
+
+static inline uint16_t Clamp16(float v)
+{
+    return (uint16_t)std::clamp<long>(lrintf(v), 0, 0xffff);
+}
+
+static void FilterV_C(const uint16_t* const* rows, const float* w, int taps, float* dst, int x, int width)
+{
+    for (; x < width; ++x) {
+        float v = 0;
+        for (int k = 0; k < taps; ++k)
+            v += w[k] * rows[k][x];
+        dst[x] = v;
+    }
+}
+
+static void FilterH_C(const float* src, const FilterTaps& t, uint16_t* dst, int i, int width)
+{
+    for (; i < width; ++i) {
+        const auto s = src + t.start[i];
+        const auto w = &t.weights[(size_t)i * t.stride];
+        float v = 0;
+        for (int k = 0; k < t.taps; ++k)
+            v += w[k] * s[k];
+        dst[i] = Clamp16(v);
+    }
+}
+
+#if (R3D_AVX2 + 0)
+R3D_TARGET("avx2") static int FilterV_AVX2(const uint16_t* const* rows, const float* w, int taps, float* dst, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        auto v = _mm256_setzero_ps();
+        for (int k = 0; k < taps; ++k) {
+            const auto s = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(rows[k] + x))));
+            v = _mm256_add_ps(v, _mm256_mul_ps(s, _mm256_set1_ps(w[k])));
+        }
+        _mm256_storeu_ps(dst + x, v);
+    }
+    return x;
+}
+
+R3D_TARGET("avx2") static inline __m256 Dot_AVX2(const float* s, const float* w, int stride)
+{
+    auto v = _mm256_mul_ps(_mm256_loadu_ps(s), _mm256_loadu_ps(w));
+    for (int k = 8; k < stride; k += 8)
+        v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_loadu_ps(s + k), _mm256_loadu_ps(w + k)));
+    return v;
+}
+
+// 8 outputs a time, dot products are reduced together
+R3D_TARGET("avx2") static int FilterH_AVX2(const float* src, const FilterTaps& t, uint16_t* dst, int width)
+{
+    int i = 0;
+    for (; i + 8 <= width; i += 8) {
+        __m256 d[8];
+        for (int j = 0; j < 8; ++j)
+            d[j] = Dot_AVX2(src + t.start[i + j], &t.weights[(size_t)(i + j) * t.stride], t.stride);
+        const auto s0 = _mm256_hadd_ps(_mm256_hadd_ps(d[0], d[1]), _mm256_hadd_ps(d[2], d[3])); // 0~3 low half | 0~3 high half
+        const auto s1 = _mm256_hadd_ps(_mm256_hadd_ps(d[4], d[5]), _mm256_hadd_ps(d[6], d[7]));
+        const auto v = _mm256_add_ps(_mm256_permute2f128_ps(s0, s1, 0x20), _mm256_permute2f128_ps(s0, s1, 0x31));
+        const auto q = _mm256_cvtps_epi32(v);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1)));
+    }
+    return i;
+}
+#endif // R3D_AVX2
+
+#if (R3D_NEON64 + 0)
+static int FilterV_NEON(const uint16_t* const* rows, const float* w, int taps, float* dst, int width)
+{
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        auto lo = vdupq_n_f32(0);
+        auto hi = vdupq_n_f32(0);
+        for (int k = 0; k < taps; ++k) {
+            const auto s = vld1q_u16(rows[k] + x);
+            lo = vmlaq_n_f32(lo, vcvtq_f32_u32(vmovl_u16(vget_low_u16(s))), w[k]);
+            hi = vmlaq_n_f32(hi, vcvtq_f32_u32(vmovl_high_u16(s)), w[k]);
+        }
+        vst1q_f32(dst + x, lo);
+        vst1q_f32(dst + x + 4, hi);
+    }
+    return x;
+}
+
+static int FilterH_NEON(const float* src, const FilterTaps& t, uint16_t* dst, int width)
+{
+    for (int i = 0; i < width; ++i) {
+        const auto s = src + t.start[i];
+        const auto w = &t.weights[(size_t)i * t.stride];
+        auto v = vmulq_f32(vld1q_f32(s), vld1q_f32(w));
+        for (int k = 4; k < t.stride; k += 4)
+            v = vmlaq_f32(v, vld1q_f32(s + k), vld1q_f32(w + k));
+        dst[i] = Clamp16(vaddvq_f32(v));
+    }
+    return width;
+}
+#endif // R3D_NEON64
+
+void FilterV(const uint16_t* const* rows, const float* w, int taps, float* dst, int width)
+{
+    int x = 0;
+#if (R3D_AVX2 + 0)
+    if (HasAVX2())
+        x = FilterV_AVX2(rows, w, taps, dst, width);
+#elif (R3D_NEON64 + 0)
+    x = FilterV_NEON(rows, w, taps, dst, width);
+#endif
+    FilterV_C(rows, w, taps, dst, x, width);
+}
+
+void FilterH(const float* src, const FilterTaps& t, uint16_t* dst, int width)
+{
+    int i = 0;
+#if (R3D_AVX2 + 0)
+    if (HasAVX2())
+        i = FilterH_AVX2(src, t, dst, width);
+#elif (R3D_NEON64 + 0)
+    i = FilterH_NEON(src, t, dst, width);
+#endif
+    FilterH_C(src, t, dst, i, width);
+}
+
+MDK_NS_END
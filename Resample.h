@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/global.h"
+#include <cstdint>
+#include <vector>
+
+MDK_NS_BEGIN
+
+// Separable resampling of 16bit planes, used by ConvertFrame() row by row: a vertical pass to a float row of source width, then a horizontal pass to output width.
+// Filters are stretched when downscaling, so a source pixel always contributes.
+enum class Filter {
+    None,
+    Bilinear,
+    Lanczos, // 3 lobes
+};
+
+// weights of a dimension. output i = sum(weights[i*taps + k] * input[start[i] + k]), k in [0, taps). start[i] + taps <= input size
+struct FilterTaps {
+    int taps = 0;
+    std::vector<int> start;
+    std::vector<float> weights; // padded to a multiple of 8 taps with 0
+    int stride = 0; // weights of an output
+};
+
+FilterTaps MakeTaps(int srcSize, int dstSize, Filter filter);
+// dst[x] = sum(w[k] * rows[k][x]), x in [0, width)
+void FilterV(const uint16_t* const* rows, const float* w, int taps, float* dst, int width);
+// src is padded to t.start.back() + t.stride with finite values
+void FilterH(const float* src, const FilterTaps& t, uint16_t* dst, int width);
+
+MDK_NS_END
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+// SSE2 is always available on x86. AVX2 functions are compiled with R3D_TARGET("avx2") and selected by HasAVX2() at runtime
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+# include <immintrin.h>
+# define R3D_X86 1
+#elif (__ARM_NEON + 0) || defined(_M_ARM64)
+# include <arm_neon.h>
+# define R3D_NEON 1
+# if defined(__aarch64__) || defined(_M_ARM64)
+#  define R3D_NEON64 1
+# endif
+#endif
+
+#if (R3D_X86 + 0)
+# if defined(__GNUC__) || defined(__clang__)
+#  define R3D_TARGET(x) __attribute__((target(x)))
+# else
+#  define R3D_TARGET(x)
+# endif
+# if defined(__GNUC__) || defined(__clang__) || defined(__AVX2__)
+#  define R3D_AVX2 1
+inline bool HasAVX2()
+{
+#  if defined(__AVX2__)
+    return true;
+#  else
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#  endif
+}
+# endif
+#endif // R3D_X86
@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#include "Waveform.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+
+using namespace std;
+
+MDK_NS_BEGIN
+
+constexpr float kScale = 1.0f / 2147483648.0f;
+constexpr int kMaxVectors = 16; // lcm(channels, 4) / 4
+
+struct SidecarHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t channels;
+    uint32_t sampleRate;
+    uint32_t samplesPerPeak;
+    uint32_t levelScale;
+    uint32_t levels;
+    uint64_t fingerprint;
+    uint64_t frames;
+};
+static const char kMagic[8] = {'R', '3', 'D', 'P', 'E', 'A', 'K', 'S'};
+
+// min, max and sum of squares of each channel of interleaved samples.
+// a vector always holds the same channels if a run of lcm(channels, 4) samples is loaded into lcm(channels, 4) / 4 vectors
+static void Accumulate(const int32_t* s, size_t frames, int channels, float* mn, float* mx, double* sq)
+{
+    const size_t total = frames * channels;
+    size_t done = 0;
+#if (R3D_X86 + 0) || (R3D_NEON + 0)
+    const int nv = std::lcm(channels, 4) / 4;
+    const size_t step = 4 * nv;
+    if (nv <= kMaxVectors && total >= step) {
+        float vmin[kMaxVectors][4], vmax[kMaxVectors][4], vsq[kMaxVectors][4];
+# if (R3D_X86 + 0)
+        __m128 amin[kMaxVectors], amax[kMaxVectors], asq[kMaxVectors];
+        const auto scale = _mm_set1_ps(kScale);
+        for (int v = 0; v < nv; ++v) {
+            amin[v] = _mm_set1_ps(1.0f);
+            amax[v] = _mm_set1_ps(-1.0f);
+            asq[v] = _mm_setzero_ps();
+        }
+        for (; done + step <= total; done += step) {
+            for (int v = 0; v < nv; ++v) {
+                const auto x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(s + done + v * 4))), scale);
+                amin[v] = _mm_min_ps(amin[v], x);
+                amax[v] = _mm_max_ps(amax[v], x);
+                asq[v] = _mm_add_ps(asq[v], _mm_mul_ps(x, x));
+            }
+        }
+        for (int v = 0; v < nv; ++v) {
+            _mm_storeu_ps(vmin[v], amin[v]);
+            _mm_storeu_ps(vmax[v], amax[v]);
+            _mm_storeu_ps(vsq[v], asq[v]);
+        }
+# else
+        float32x4_t amin[kMaxVectors], amax[kMaxVectors], asq[kMaxVectors];
+        for (int v = 0; v < nv; ++v) {
+            amin[v] = vdupq_n_f32(1.0f);
+            amax[v] = vdupq_n_f32(-1.0f);
+            asq[v] = vdupq_n_f32(0);
+        }
+        for (; done + step <= total; done += step) {
+            for (int v = 0; v < nv; ++v) {
+                const auto x = vmulq_n_f32(vcvtq_f32_s32(vld1q_s32(s + done + v * 4)), kScale);
+                amin[v] = vminq_f32(amin[v], x);
+                amax[v] = vmaxq_f32(amax[v], x);
+                asq[v] = vmlaq_f32(asq[v], x, x);
+            }
+        }
+        for (int v = 0; v < nv; ++v) {
+            vst1q_f32(vmin[v], amin[v]);
+            vst1q_f32(vmax[v], amax[v]);
+            vst1q_f32(vsq[v], asq[v]);
+        }
+# endif
+        for (int v = 0; v < nv; ++v) {
+            for (int i = 0; i < 4; ++i) {
+                const auto c = (v * 4 + i) % channels;
+                mn[c] = std::min(mn[c], vmin[v][i]);
+                mx[c] = std::max(mx[c], vmax[v][i]);
+                sq[c] += vsq[v][i];
+            }
+        }
+    }
+#endif
+    // done is a multiple of channels
+    for (size_t i = done; i < total; ++i) {
+        const auto c = (i - done) % channels;
+        const auto x = (float)s[i] * kScale;
+        mn[c] = std::min(mn[c], x);
+        mx[c] = std::max(mx[c], x);
+        sq[c] += x * x;
+    }
+}
+
+void Waveform::reset(int channels, int sampleRate, uint64_t fingerprint)
+{
+    channels_ = channels;
+    sample_rate_ = sampleRate;
+    fingerprint_ = fingerprint;
+    frames_ = 0;
+    pending_ = 0;
+    min_.assign(channels, 1.0f);
+    max_.assign(channels, -1.0f);
+    sq_.assign(channels, 0);
+    levels_.assign(1, {});
+}
+
+void Waveform::add(const int32_t* samples, size_t frames)
+{
+    while (frames > 0) {
+        const auto n = std::min<size_t>(frames, kSamplesPerPeak - pending_);
+        Accumulate(samples, n, channels_, min_.data(), max_.data(), sq_.data());
+        samples += n * channels_;
+        frames -= n;
+        pending_ += n;
+        frames_ += n;
+        if (pending_ == kSamplesPerPeak)
+            flush();
+    }
+}
+
+void Waveform::flush()
+{
+    for (int c = 0; c < channels_; ++c) {
+        levels_[0].push_back(Peak{min_[c], max_[c], (float)std::sqrt(sq_[c] / pending_)});
+        min_[c] = 1.0f;
+        max_[c] = -1.0f;
+        sq_[c] = 0;
+    }
+    pending_ = 0;
+}
+
+void Waveform::finish()
+{
+    if (pending_ > 0)
+        flush();
+    levels_.resize(1);
+    while ((int)levels_.size() < kMaxLevels && levels_.back().size() > (size_t)channels_ * kLevelScale) {
+        const auto& low = levels_.back();
+        const auto n = low.size() / channels_;
+        vector<Peak> high;
+        high.reserve((n + kLevelScale - 1) / kLevelScale * channels_);
+        for (size_t i = 0; i < n; i += kLevelScale) {
+            const auto m = std::min<size_t>(kLevelScale, n - i);
+            for (int c = 0; c < channels_; ++c) {
+                Peak p{1.0f, -1.0f, 0};
+                double sq = 0;
+                for (size_t k = 0; k < m; ++k) {
+                    const auto& q = low[(i + k) * channels_ + c];
+                    p.min = std::min(p.min, q.min);
+                    p.max = std::max(p.max, q.max);
+                    sq += (double)q.rms * q.rms;
+                }
+                p.rms = (float)std::sqrt(sq / m);
+                high.push_back(p);
+            }
+        }
+        levels_.push_back(std::move(high));
+    }
+}
+
+bool Waveform::save(const char* path) const
+{
+    const string tmp = string(path) + ".tmp"; // readers never see a partial file
+    auto f = fopen(tmp.data(), "wb");
+    if (!f)
+        return false;
+    SidecarHeader h{};
+    memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = 1;
+    h.channels = channels_;
+    h.sampleRate = sample_rate_;
+    h.samplesPerPeak = kSamplesPerPeak;
+    h.levelScale = kLevelScale;
+    h.levels = (uint32_t)levels_.size();
+    h.fingerprint = fingerprint_;
+    h.frames = frames_;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (const auto& l : levels_) {
+        const uint64_t n = l.size();
+        ok = ok && fwrite(&n, sizeof(n), 1, f) == 1 && (n == 0 || fwrite(l.data(), sizeof(Peak), n, f) == n);
+    }
+    ok = fclose(f) == 0 && ok;
+    if (ok)
+        ok = rename(tmp.data(), path) == 0;
+    if (!ok)
+        remove(tmp.data());
+    return ok;
+}
+
+bool Waveform::load(const char* path, int channels, int sampleRate, uint64_t fingerprint)
+{
+    auto f = fopen(path, "rb");
+    if (!f)
+        return false;
+    SidecarHeader h{};
+    bool ok = fread(&h, sizeof(h), 1, f) == 1
+        && memcmp(h.magic, kMagic, sizeof(kMagic)) == 0 && h.version == 1
+        && h.channels == (uint32_t)channels && h.sampleRate == (uint32_t)sampleRate && h.fingerprint == fingerprint
+        && h.samplesPerPeak == kSamplesPerPeak && h.levelScale == kLevelScale && h.levels > 0 && h.levels <= kMaxLevels;
+    vector<vector<Peak>> levels;
+    for (uint32_t i = 0; ok && i < h.levels; ++i) {
+        uint64_t n = 0;
+        ok = fread(&n, sizeof(n), 1, f) == 1 && n % channels == 0 && n <= (h.frames / kSamplesPerPeak + 1) * channels;
+        if (!ok)
+            break;
+        vector<Peak> l(n);
+        ok = n == 0 || fread(l.data(), sizeof(Peak), n, f) == n;
+        levels.push_back(std::move(l));
+    }
+    fclose(f);
+    if (!ok)
+        return false;
+    reset(channels, sampleRate, fingerprint);
+    frames_ = h.frames;
+    levels_ = std::move(levels);
+    return true;
+}
+
+MDK_NS_END
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2026 WangBin <wbsecg1 at gmail.com>
+ * r3d plugin for libmdk
+ */
+#pragma once
+#include "mdk/global.h"
+#include <cstdint>
+#include <vector>
+
+MDK_NS_BEGIN
+
+// Multi-resolution waveform overview of interleaved s32 audio.
+// Level 0 has a peak per kSamplesPerPeak frames of each channel, a peak of level i + 1 covers kLevelScale peaks of level i.
+class Waveform
+{
+public:
+    struct Peak {
+        float min; // normalized to [-1, 1]
+        float max;
+        float rms;
+    };
+    static constexpr uint32_t kSamplesPerPeak = 256;
+    static constexpr uint32_t kLevelScale = 4;
+    static constexpr int kMaxLevels = 8;
+
+    // fingerprint identifies the source, a sidecar of another source is not loaded
+    void reset(int channels, int sampleRate, uint64_t fingerprint);
+    // native s32 samples
+    void add(const int32_t* samples, size_t frames);
+    // flush the last partial peak and build higher levels
+    void finish();
+
+    int channels() const { return channels_; }
+    int levels() const { return (int)levels_.size(); }
+    // peaks of level, channel c of peak i is [i * channels() + c]
+    const std::vector<Peak>& peaks(int level) const { return levels_[level]; }
+
+    bool save(const char* path) const;
+    // false if not a valid sidecar of the same source
+    bool load(const char* path, int channels, int sampleRate, uint64_t fingerprint);
+private:
+    void flush();
+
+    int channels_ = 0;
+    int sample_rate_ = 0;
+    uint64_t fingerprint_ = 0;
+    uint64_t frames_ = 0;
+    size_t pending_ = 0; // frames in current peak
+    std::vector<float> min_;
+    std::vector<float> max_;
+    std::vector<double> sq_;
+    std::vector<std::vector<Peak>> levels_;
+};
+
+MDK_NS_END